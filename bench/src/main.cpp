@@ -0,0 +1,807 @@
+//
+//  main.cpp
+//  CircleTree bench
+//
+
+// Windowless benchmarks for the tree pipeline: generation, snapshot loading,
+// animator installation, animation (by channels, compile-time functors,
+// function pointers and script) and track playback, world transforms, the
+// CPU side of the batch drawers, picking queries, forests of the same tree
+// and GL-free copies of the immediate-mode drawers' traversals.
+// Results go to stdout (or --out) as JSON.
+
+#include "ofMain.h"
+#include "Trees.hpp"
+#include "BatchDrawers.hpp"
+#include "Forest.hpp"
+#include "AnimatorScript.hpp"
+#include "StaticAnimators.hpp"
+#include "SpatialIndex.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <sys/resource.h>
+
+//--------------------------------------------------------------
+// Every allocation made through operator new is counted, including those
+// made on pool threads.
+
+static std::atomic<uint64_t> allocationCount(0);
+static std::atomic<uint64_t> allocationBytes(0);
+
+void *operator new(size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocationBytes.fetch_add(size, std::memory_order_relaxed);
+    void *memory = malloc(size > 0 ? size : 1);
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+// Every operator delete frees through here. Kept out of line so GCC doesn't
+// inline free() into callers of operator new and warn about the mismatch
+// (-Wmismatched-new-delete); both sides are malloc's here.
+__attribute__((noinline)) static void release(void *memory) {
+    free(memory);
+}
+
+void operator delete(void *memory) noexcept {
+    release(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept {
+    release(memory);
+}
+
+// Node storage is allocated 64-byte aligned.
+void *operator new(size_t size, std::align_val_t alignment) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocationBytes.fetch_add(size, std::memory_order_relaxed);
+    void *memory = nullptr;
+    if (posix_memalign(&memory, std::max((size_t)alignment, sizeof(void *)), size > 0 ? size : 1) != 0) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void *memory, std::align_val_t) noexcept {
+    release(memory);
+}
+
+void operator delete(void *memory, size_t, std::align_val_t) noexcept {
+    release(memory);
+}
+
+static uint64_t peakResidentBytes() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+static const char *simdLevel() {
+#if defined(__AVX2__)
+    return "avx2";
+#elif defined(__SSE2__)
+    return "sse2";
+#elif defined(__ARM_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+//--------------------------------------------------------------
+// GL-free copies of the immediate-mode drawers: the same traversal and the
+// same matrix work, with a local stack instead of ofPushMatrix and a
+// checksum instead of the draw calls.
+
+class MatrixStack {
+public:
+    glm::mat4 top;
+    
+    MatrixStack(): top(1) {
+    }
+    
+    void push() {
+        stack.push_back(top);
+    }
+    
+    void pop() {
+        top = stack.back();
+        stack.pop_back();
+    }
+    
+    void applyBranch(const Tree *tree, int node) {
+        const TreeNodes &nodes = tree->nodes;
+        top = glm::rotate(top, ofDegToRad(nodes.terminusAngle[node]), glm::vec3(0, 0, 1));
+        top = glm::translate(top, glm::vec3(0, -tree->size/2 - nodes.offset[node] * tree->size / 2, 0));
+        top = glm::scale(top, glm::vec3(nodes.size[node], nodes.size[node], 1));
+        top = glm::rotate(top, ofDegToRad(nodes.branchAngle[node]), glm::vec3(0, 0, 1));
+    }
+    
+private:
+    std::vector<glm::mat4> stack;
+};
+
+class CircleTraversal: public TreeVisitor<CircleTraversal, bool, bool> {
+public:
+    MatrixStack matrices;
+    float checksum;
+    
+    CircleTraversal(Tree *tree): TreeVisitor(tree), checksum(0) {
+    }
+    
+    bool allowsParallelVisit() {
+        return false;
+    }
+    
+    void visitAll() {
+        TreeVisitor::visitAll(true, true);
+    }
+    
+    void preVisit(int node, int currentDepth, bool data) {
+        matrices.push();
+        matrices.applyBranch(tree, node);
+    }
+    
+    void visitNode(int node, int currentDepth, bool data) {
+        checksum += matrices.top[3].x + matrices.top[0].x * tree->size;
+    }
+    
+    void postVisit(int node, int currentDepth, bool data) {
+        matrices.pop();
+    }
+};
+
+class LeafTraversal: public TreeVisitor<LeafTraversal, float, bool> {
+public:
+    MatrixStack matrices;
+    float checksum;
+    
+    LeafTraversal(Tree *tree): TreeVisitor(tree), checksum(0) {
+    }
+    
+    bool allowsParallelVisit() {
+        return false;
+    }
+    
+    void visitAll() {
+        TreeVisitor::visitAll(1, true);
+    }
+    
+    void preVisit(int node, int currentDepth, float currentScale) {
+        matrices.push();
+        matrices.applyBranch(tree, node);
+    }
+    
+    void postVisit(int node, int currentDepth, float currentScale) {
+        int height = tree->nodes.height[node];
+        ofColor color = treePaletteColor(defaultTreePalette(), height);
+        glm::mat4 line = glm::scale(matrices.top, glm::vec3(1.0 / currentScale, 1.0 / currentScale, 1));
+        glm::vec4 end = line * glm::vec4(1, 1, 0, 1);
+        checksum += end.x + color.a;
+        matrices.pop();
+    }
+    
+    float modifyData(int currentDepth, int node, float currentScale) {
+        return currentScale * tree->nodes.size[node];
+    }
+};
+
+class BranchTraversal: public TreeVisitor<BranchTraversal, int, bool> {
+public:
+    MatrixStack matrices;
+    float checksum;
+    
+    BranchTraversal(Tree *tree): TreeVisitor(tree), checksum(0) {
+    }
+    
+    bool allowsParallelVisit() {
+        return false;
+    }
+    
+    void preVisit(int node, int currentDepth, int parentNode) {
+        matrices.push();
+        matrices.applyBranch(tree, node);
+    }
+    
+    void postVisit(int node, int currentDepth, int parentNode) {
+        checksum += matrices.top[3].x;
+        matrices.pop();
+    }
+};
+
+//--------------------------------------------------------------
+
+struct BenchSettings {
+    int minDepth = 4;
+    int maxDepth = 11;
+    std::vector<int> fanOuts = { 2, 4 };
+    int repetitions = 7;
+    int threads = 0;
+    int maxNodes = 4000000;
+    std::string output;
+    
+    bool parse(int argc, char *argv[]) {
+        for (int i = 1; i < argc; i++) {
+            std::string option = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (option == "--depths" && hasValue) {
+                std::string range = argv[++i];
+                size_t dash = range.find('-');
+                minDepth = ofToInt(range.substr(0, dash));
+                maxDepth = dash == std::string::npos ? minDepth : ofToInt(range.substr(dash + 1));
+            } else if (option == "--fanouts" && hasValue) {
+                fanOuts.clear();
+                for (const std::string &fanOut: ofSplitString(argv[++i], ",", true, true)) {
+                    fanOuts.push_back(ofToInt(fanOut));
+                }
+            } else if (option == "--reps" && hasValue) {
+                repetitions = max(ofToInt(argv[++i]), 1);
+            } else if (option == "--threads" && hasValue) {
+                threads = ofToInt(argv[++i]);
+            } else if (option == "--max-nodes" && hasValue) {
+                maxNodes = ofToInt(argv[++i]);
+            } else if (option == "--out" && hasValue) {
+                output = argv[++i];
+            } else {
+                fprintf(stderr, "usage: %s [--depths 4-11] [--fanouts 2,4] [--reps n] [--threads n] [--max-nodes n] [--out file.json]\n", argv[0]);
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+struct Measurement {
+    std::string name;
+    int depth;
+    int fanOut;
+    int nodes;
+    int threads;
+    double medianNs;
+    double minNs;
+    uint64_t allocations;
+    uint64_t allocatedBytes;
+    uint64_t peakRss;
+};
+
+// Runs body once to warm up, then repetitions more times, timing each run.
+// Allocation counts are from the last run, i.e. the steady state; teardown
+// runs after each timed run and isn't counted.
+template <typename Body, typename Teardown>
+Measurement measure(const BenchSettings &settings, Body body, Teardown teardown) {
+    body();
+    teardown();
+    
+    std::vector<double> times;
+    Measurement measurement;
+    for (int i = 0; i < settings.repetitions; i++) {
+        uint64_t count = allocationCount.load();
+        uint64_t bytes = allocationBytes.load();
+        auto start = std::chrono::steady_clock::now();
+        body();
+        auto end = std::chrono::steady_clock::now();
+        measurement.allocations = allocationCount.load() - count;
+        measurement.allocatedBytes = allocationBytes.load() - bytes;
+        teardown();
+        times.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+    }
+    std::sort(times.begin(), times.end());
+    measurement.medianNs = times[times.size() / 2];
+    measurement.minNs = times.front();
+    measurement.peakRss = peakResidentBytes();
+    return measurement;
+}
+
+template <typename Body>
+Measurement measure(const BenchSettings &settings, Body body) {
+    return measure(settings, body, []() {});
+}
+
+static std::vector<NodeAnimator *> benchAnimators() {
+    // The channel animators ofApp::setup installs.
+    return {
+        new NodeAnimator(NodeAnimatorChannels(AnimatorChannel::constant(), AnimatorChannel::constant(),
+                                              AnimatorChannel::sine(-45, 90, 1.0/2, 1.0/100),
+                                              AnimatorChannel::sine(0.4, 0.1, 1),
+                                              AnimatorChannel::cosine(0.1, 0.1, 1.0/20))),
+        new NodeAnimator(NodeAnimatorChannels(AnimatorChannel::constant(), AnimatorChannel::constant(),
+                                              AnimatorChannel::cosine(-15, 30, 1.0/5, 1.0/50),
+                                              AnimatorChannel::sine(0.3, 0.1, 1.0/2),
+                                              AnimatorChannel::cosine(0, 0.3, 1.0/30))),
+        new NodeAnimator(NodeAnimatorChannels(AnimatorChannel::constant(), AnimatorChannel::constant(),
+                                              AnimatorChannel::sine(-90, 180, 1, 1.0/320),
+                                              AnimatorChannel::sine(0.5, 0.1, 1).ofSqrtTime(),
+                                              AnimatorChannel::cosine(0.2, 0.3, 1.0/10))),
+        new NodeAnimator(NodeAnimatorChannels(AnimatorChannel::constant(), AnimatorChannel::constant(),
+                                              AnimatorChannel::drift(1),
+                                              AnimatorChannel::sine(0.5, 0.1, 1),
+                                              AnimatorChannel::cosine(0.2, 0.3, 1.0/10))),
+        new NodeAnimator(NodeAnimatorChannels(AnimatorChannel::constant(), AnimatorChannel::constant(),
+                                              AnimatorChannel::drift(0.5),
+                                              AnimatorChannel::sine(0.5, 0.1, 1),
+                                              AnimatorChannel::cosine(0.2, 0.3, 1.0/10))),
+        new NodeAnimator(NodeAnimatorChannels(AnimatorChannel::constant(), AnimatorChannel::constant(),
+                                              AnimatorChannel::drift(-0.7),
+                                              AnimatorChannel::sine(0.5, 0.1, 1),
+                                              AnimatorChannel::cosine(0.2, 0.3, 1.0/10))),
+    };
+}
+
+// benchAnimators as StaticNodeAnimators.
+static std::vector<NodeAnimator *> benchStaticAnimators() {
+    return {
+        makeStaticNodeAnimator(ConstantChannel(), ConstantChannel(),
+                               SineChannel(-45, 90, 1.0/2, 1.0/100),
+                               SineChannel(0.4, 0.1, 1),
+                               CosineChannel(0.1, 0.1, 1.0/20)),
+        makeStaticNodeAnimator(ConstantChannel(), ConstantChannel(),
+                               CosineChannel(-15, 30, 1.0/5, 1.0/50),
+                               SineChannel(0.3, 0.1, 1.0/2),
+                               CosineChannel(0, 0.3, 1.0/30)),
+        makeStaticNodeAnimator(ConstantChannel(), ConstantChannel(),
+                               SineChannel(-90, 180, 1, 1.0/320),
+                               SqrtTimeChannel<SineChannel>(SineChannel(0.5, 0.1, 1)),
+                               CosineChannel(0.2, 0.3, 1.0/10)),
+        makeStaticNodeAnimator(ConstantChannel(), ConstantChannel(),
+                               DriftChannel(1),
+                               SineChannel(0.5, 0.1, 1),
+                               CosineChannel(0.2, 0.3, 1.0/10)),
+        makeStaticNodeAnimator(ConstantChannel(), ConstantChannel(),
+                               DriftChannel(0.5),
+                               SineChannel(0.5, 0.1, 1),
+                               CosineChannel(0.2, 0.3, 1.0/10)),
+        makeStaticNodeAnimator(ConstantChannel(), ConstantChannel(),
+                               DriftChannel(-0.7),
+                               SineChannel(0.5, 0.1, 1),
+                               CosineChannel(0.2, 0.3, 1.0/10)),
+    };
+}
+
+// benchAnimators as AnimatorFunctions, called once per node and field.
+static std::vector<NodeAnimator *> benchFunctionAnimators() {
+    AnimatorFunction constant = nullptr;
+    return {
+        new NodeAnimator(NodeAnimatorFunctions(constant, constant,
+                                               [](float v, float d) { return -45 + 90 * sinf(d / 2 + v / 100); },
+                                               [](float v, float d) { return 0.4f + 0.1f * sinf(d); },
+                                               [](float v, float d) { return 0.1f + 0.1f * cosf(d / 20); })),
+        new NodeAnimator(NodeAnimatorFunctions(constant, constant,
+                                               [](float v, float d) { return -15 + 30 * cosf(d / 5 + v / 50); },
+                                               [](float v, float d) { return 0.3f + 0.1f * sinf(d / 2); },
+                                               [](float v, float d) { return 0.3f * cosf(d / 30); })),
+        new NodeAnimator(NodeAnimatorFunctions(constant, constant,
+                                               [](float v, float d) { return -90 + 180 * sinf(d + v / 320); },
+                                               [](float v, float d) { return 0.5f + 0.1f * sinf(sqrtf(d)); },
+                                               [](float v, float d) { return 0.2f + 0.3f * cosf(d / 10); })),
+        new NodeAnimator(NodeAnimatorFunctions(constant, constant,
+                                               [](float v, float d) { return v + 1; },
+                                               [](float v, float d) { return 0.5f + 0.1f * sinf(d); },
+                                               [](float v, float d) { return 0.2f + 0.3f * cosf(d / 10); })),
+        new NodeAnimator(NodeAnimatorFunctions(constant, constant,
+                                               [](float v, float d) { return v + 0.5f; },
+                                               [](float v, float d) { return 0.5f + 0.1f * sinf(d); },
+                                               [](float v, float d) { return 0.2f + 0.3f * cosf(d / 10); })),
+        new NodeAnimator(NodeAnimatorFunctions(constant, constant,
+                                               [](float v, float d) { return v - 0.7f; },
+                                               [](float v, float d) { return 0.5f + 0.1f * sinf(d); },
+                                               [](float v, float d) { return 0.2f + 0.3f * cosf(d / 10); })),
+    };
+}
+
+// benchAnimators as an AnimatorScript.
+static const char *benchAnimatorScript =
+    "[animator]\n"
+    "terminusAngle = -45 + 90 * sin(d/2 + v/100)\n"
+    "size = 0.4 + 0.1 * sin(d)\n"
+    "offset = 0.1 + 0.1 * cos(d/20)\n"
+    "[animator]\n"
+    "terminusAngle = -15 + 30 * cos(d/5 + v/50)\n"
+    "size = 0.3 + 0.1 * sin(d/2)\n"
+    "offset = 0.3 * cos(d/30)\n"
+    "[animator]\n"
+    "terminusAngle = -90 + 180 * sin(d + v/320)\n"
+    "size = 0.5 + 0.1 * sin(sqrt(d))\n"
+    "offset = 0.2 + 0.3 * cos(d/10)\n"
+    "[animator]\n"
+    "terminusAngle = v + 1\n"
+    "size = 0.5 + 0.1 * sin(d)\n"
+    "offset = 0.2 + 0.3 * cos(d/10)\n"
+    "[animator]\n"
+    "terminusAngle = v + 0.5\n"
+    "size = 0.5 + 0.1 * sin(d)\n"
+    "offset = 0.2 + 0.3 * cos(d/10)\n"
+    "[animator]\n"
+    "terminusAngle = v - 0.7\n"
+    "size = 0.5 + 0.1 * sin(d)\n"
+    "offset = 0.2 + 0.3 * cos(d/10)\n";
+
+static NodeAnimator *benchShallowChooser(Tree *tree, int node, int depth, const std::vector<NodeAnimator *> &animators) {
+    return node == tree->nodes.firstChild[Tree::root] ? animators[3] : nullptr;
+}
+
+// Keeps the traversals' results observable so they aren't optimized away.
+static volatile float checksumSink;
+
+static NodeAnimator *benchChooser(Tree *tree, int node, int depth, const std::vector<NodeAnimator *> &animators) {
+    return animators[3 + ofRandom(3)];
+}
+
+// Cases that made heap allocations in their steady state although they
+// promise not to. Any fail the run.
+static int allocationFailures = 0;
+
+static void expectNoAllocations(const Measurement &measurement) {
+    if (measurement.allocations > 0) {
+        fprintf(stderr, "%s (depth %d, fan-out %d, %d threads) made %llu allocations\n",
+                measurement.name.c_str(), measurement.depth, measurement.fanOut, measurement.threads,
+                (unsigned long long)measurement.allocations);
+        allocationFailures++;
+    }
+}
+
+// Trees whose cached depth, height, leafCount or subtreeSize didn't match a
+// recount. Any fail the run.
+static int structureFailures = 0;
+
+// Recounts the structure the slow way, walking every node up to the root,
+// so it shares nothing with add() or updateStructure().
+static void expectCachedStructure(const char *when, const TreeNodes &nodes, int depth, int fanOut) {
+    int count = nodes.count();
+    std::vector<bool> hasChildren(count, false);
+    for (int node = 1; node < count; node++) {
+        hasChildren[nodes.parent[node]] = true;
+    }
+    std::vector<int> height(count, 0), leafCount(count, 0), subtreeSize(count, 0);
+    int mismatches = 0;
+    for (int node = 0; node < count; node++) {
+        int distance = 0;
+        for (int ancestor = node; ancestor >= 0; ancestor = nodes.parent[ancestor], distance++) {
+            height[ancestor] = max(height[ancestor], distance);
+            leafCount[ancestor] += hasChildren[node] ? 0 : 1;
+            subtreeSize[ancestor]++;
+        }
+        if (nodes.depth[node] != distance - 1) {
+            mismatches++;
+        }
+    }
+    for (int node = 0; node < count; node++) {
+        if (nodes.height[node] != height[node] || nodes.leafCount[node] != leafCount[node] ||
+            nodes.subtreeSize[node] != subtreeSize[node]) {
+            mismatches++;
+        }
+    }
+    if (mismatches > 0) {
+        fprintf(stderr, "%s (depth %d, fan-out %d): %d cached node structures don't match a recount\n",
+                when, depth, fanOut, mismatches);
+        structureFailures++;
+    }
+}
+
+// Queries per picking benchmark run.
+static const int pickQueries = 1000;
+
+// Nodes across all of a forest benchmark's instances.
+static const int forestNodes = 1 << 18;
+
+static void benchTree(const BenchSettings &settings, ThreadPool *pool, int depth, int fanOut, std::vector<Measurement> &results) {
+    TreeGenerator generator(depth, 100, fanOut);
+    int count = generator.nodeCount();
+    std::vector<Measurement> measurements;
+    auto record = [&](const std::string &name, int threads, Measurement measurement) {
+        measurement.name = name;
+        measurement.depth = depth;
+        measurement.fanOut = fanOut;
+        measurement.nodes = count;
+        measurement.threads = threads;
+        results.push_back(measurement);
+    };
+    int workers = pool == nullptr ? 1 : pool->workerCount() + 1;
+    
+    Tree *generated = nullptr;
+    record("generate", 1, measure(settings, [&]() { generated = generator.generateTree(); },
+                                  [&]() { delete generated; }));
+    
+    Tree *tree = generator.generateTree();
+    expectCachedStructure("generated", tree->nodes, depth, fanOut);
+    TreeNodes copy(tree->nodes);
+    expectCachedStructure("copied", copy, depth, fanOut);
+    // Uneven fan-outs, grown breadth-first one add() at a time. The last
+    // node so far always gets a child, so growth can't die out early.
+    TreeNodes grown;
+    grown.add(BranchParameters(), -1);
+    uint32_t state = depth * 31 + fanOut;
+    for (int node = 0; node < grown.count() && grown.count() < count; node++) {
+        state = state * 1664525u + 1013904223u;
+        int children = max((int)(state >> 16) % (fanOut + 2), node == grown.count() - 1 ? 1 : 0);
+        for (int child = 0; child < children && grown.count() < count; child++) {
+            grown.add(BranchParameters(), node);
+        }
+    }
+    expectCachedStructure("grown", grown, depth, fanOut);
+    grown.updateStructure();
+    expectCachedStructure("updateStructure", grown, depth, fanOut);
+    
+    std::vector<NodeAnimator *> animators = benchAnimators();
+    TreeAnimatorInstaller installer(tree, animators, &benchChooser);
+    record("install", 1, measure(settings, [&]() { installer.visitAll(); }));
+    
+    // Mapping a snapshot of the same tree, against generating it above.
+    std::string snapshot = (std::filesystem::temp_directory_path() / "bench.ctree").string();
+    if (tree->save(snapshot)) {
+        Tree *loaded = Tree::load(snapshot);
+        if (loaded != nullptr) {
+            expectCachedStructure("loaded", loaded->nodes, depth, fanOut);
+            delete loaded;
+        }
+        record("load", 1, measure(settings, [&]() { loaded = Tree::load(snapshot); },
+                                  [&]() { delete loaded; }));
+        std::filesystem::remove(snapshot);
+    }
+    
+    float time = 0;
+    TreeAnimator animator(tree);
+    record("animate", 1, measure(settings, [&]() { animator.animate(time += 1.0 / 120); }));
+    if (pool != nullptr) {
+        animator.pool = pool;
+        record("animate", workers, measure(settings, [&]() { animator.animate(time += 1.0 / 120); }));
+    }
+    
+    // The same animators through NodeAnimator's other paths, each on a tree
+    // of its own so the cases below keep the channels.
+    auto recordAnimators = [&](const std::string &name, const std::vector<NodeAnimator *> &otherAnimators) {
+        Tree *other = generator.generateTree();
+        TreeAnimatorInstaller otherInstaller(other, otherAnimators, &benchChooser);
+        otherInstaller.visitAll();
+        TreeAnimator otherAnimator(other);
+        record(name, 1, measure(settings, [&]() { otherAnimator.animate(time += 1.0 / 120); }));
+        if (pool != nullptr) {
+            otherAnimator.pool = pool;
+            record(name, workers, measure(settings, [&]() { otherAnimator.animate(time += 1.0 / 120); }));
+        }
+        delete other;
+    };
+    recordAnimators("animateStatic", benchStaticAnimators());
+    recordAnimators("animateFunctions", benchFunctionAnimators());
+    AnimatorScript script("");
+    if (script.parse(benchAnimatorScript)) {
+        recordAnimators("animateScript", script.createAnimators());
+    }
+    
+    // The same animation baked into a second of samples and played back.
+    std::string trackPath = (std::filesystem::temp_directory_path() / "bench.ctrack").string();
+    AnimationTrack *track = nullptr;
+    if (AnimationTrack::record(animator, trackPath, time, 120, 120)) {
+        track = AnimationTrack::open(trackPath);
+        std::filesystem::remove(trackPath);
+    }
+    if (track != nullptr) {
+        track->loop = true;
+        animator.track = track;
+        animator.pool = nullptr;
+        record("playTrack", 1, measure(settings, [&]() { animator.animate(time += 1.0 / 120); }));
+        if (pool != nullptr) {
+            animator.pool = pool;
+            record("playTrack", workers, measure(settings, [&]() { animator.animate(time += 1.0 / 120); }));
+        }
+        animator.track = nullptr;
+        delete track;
+    }
+    
+    // Every node is animated here, so measure full renders; renderShallow
+    // below covers the incremental case.
+    RenderedTree renderedTree;
+    TreeRenderer renderer(tree);
+    renderer.incremental = false;
+    record("render", 1, measure(settings, [&]() { renderer.render(renderedTree); }));
+    expectNoAllocations(results.back());
+    if (pool != nullptr) {
+        renderer.pool = pool;
+        record("render", workers, measure(settings, [&]() { renderer.render(renderedTree); }));
+        expectNoAllocations(results.back());
+    }
+    
+    CircleBatchDrawer circleBatchDrawer(tree);
+    record("circleBatchUpdate", 1, measure(settings, [&]() { circleBatchDrawer.update(renderedTree); }));
+    // One drawing unit per pixel, with the app's default threshold.
+    circleBatchDrawer.lod.enabled = true;
+    record("circleBatchUpdateLod", 1, measure(settings, [&]() { circleBatchDrawer.update(renderedTree); }));
+    expectNoAllocations(results.back());
+    LeafBatchDrawer leafBatchDrawer(tree);
+    record("leafBatchUpdate", 1, measure(settings, [&]() { leafBatchDrawer.update(renderedTree); }));
+    
+    // Picking: indexing a snapshot without bounds in a grid, then
+    // pickQueries hover and rectangle queries spread over the tree, against
+    // the same queries descending the snapshot's bounds.
+    SpatialIndex spatialIndex;
+    record("indexBuild", 1, measure(settings, [&]() { spatialIndex.update(tree, renderedTree); }));
+    ofRectangle extent(renderedTree.nodes[0].position.x, renderedTree.nodes[0].position.y, 0, 0);
+    for (const RenderedTreeNode &node: renderedTree.nodes) {
+        extent.growToInclude(node.position);
+    }
+    std::vector<ofPoint> pickPoints(pickQueries);
+    for (int i = 0; i < pickQueries; i++) {
+        // Golden-ratio sequences cover the extent evenly.
+        pickPoints[i] = ofPoint(extent.x + fmodf(i * 0.618034f, 1) * extent.width,
+                                extent.y + fmodf(i * 0.754878f, 1) * extent.height);
+    }
+    float span = max(extent.width, extent.height) / 32;
+    std::vector<int> picked;
+    int pickSink = 0;
+    auto pick = [&]() {
+        for (const ofPoint &point: pickPoints) {
+            pickSink += spatialIndex.nodeAt(point.x, point.y);
+        }
+    };
+    auto select = [&]() {
+        for (const ofPoint &point: pickPoints) {
+            spatialIndex.queryRectangle(ofRectangle(point.x, point.y, span, span), picked);
+            pickSink += (int)picked.size();
+        }
+    };
+    record("indexPick", 1, measure(settings, pick));
+    record("indexSelect", 1, measure(settings, select));
+    renderer.computeBounds = true;
+    renderer.render(renderedTree);
+    spatialIndex.update(tree, renderedTree);
+    record("hierarchyPick", 1, measure(settings, pick));
+    record("hierarchySelect", 1, measure(settings, select));
+    renderer.computeBounds = false;
+    renderer.render(renderedTree);
+    checksumSink = pickSink;
+    
+    // Enough instances of the tree for about forestNodes nodes in all, so
+    // small trees are measured as the wall of them the forest is for.
+    Forest forest(tree);
+    int instances = max(1, forestNodes / count);
+    for (int i = 0; i < instances; i++) {
+        forest.add(ForestInstance(i % 64 * 100.0f, i / 64 * 100.0f, 0.1f, 0, i * 0.1f, i + 1));
+    }
+    auto recordForest = [&](const std::string &name, int threads, Measurement measurement) {
+        record(name, threads, measurement);
+        results.back().nodes = instances * count;
+    };
+    recordForest("forestAnimate", 1, measure(settings, [&]() { forest.animate(time += 1.0 / 120); }));
+    recordForest("forestRender", 1, measure(settings, [&]() { forest.render(); }));
+    if (pool != nullptr) {
+        forest.pool = pool;
+        recordForest("forestAnimate", workers, measure(settings, [&]() { forest.animate(time += 1.0 / 120); }));
+        recordForest("forestRender", workers, measure(settings, [&]() { forest.render(); }));
+    }
+    CircleBatchDrawer forestCircles(tree);
+    recordForest("forestCircleBatchUpdate", 1, measure(settings, [&]() { forestCircles.update(forest); }));
+    LeafBatchDrawer forestLeaves(tree);
+    recordForest("forestLeafBatchUpdate", 1, measure(settings, [&]() { forestLeaves.update(forest); }));
+    
+    // The CPU rasterizer at the offline renderer's default size, with the
+    // tree scaled to fill it.
+    SoftwareCanvas canvas;
+    canvas.allocate(1500, 1000);
+    canvas.setTransform(750, 500, 400 / max(renderedTree.size, 1.0f));
+    auto rasterize = [&]() {
+        canvas.clear(ofFloatColor(1, 1, 1, 1));
+        leafBatchDrawer.draw(canvas);
+        circleBatchDrawer.draw(canvas);
+    };
+    record("softwareRaster", 1, measure(settings, rasterize));
+    if (pool != nullptr) {
+        canvas.pool = pool;
+        record("softwareRaster", workers, measure(settings, rasterize));
+    }
+    
+    float checksum = 0;
+    record("circleTraversal", 1, measure(settings, [&]() {
+        CircleTraversal traversal(tree);
+        traversal.visitAll();
+        checksum += traversal.checksum;
+    }));
+    record("leafTraversal", 1, measure(settings, [&]() {
+        LeafTraversal traversal(tree);
+        traversal.visitAll();
+        checksum += traversal.checksum;
+    }));
+    record("branchTraversal", 1, measure(settings, [&]() {
+        BranchTraversal traversal(tree);
+        traversal.visitAll(-1, true);
+        checksum += traversal.checksum;
+    }));
+    checksumSink = checksum;
+    
+    // Only the root's first branch animated, so the rest of the tree keeps
+    // its cached transforms.
+    TreeAnimatorInstaller shallowInstaller(tree, animators, &benchShallowChooser);
+    shallowInstaller.visitAll();
+    renderer.pool = nullptr;
+    renderer.incremental = true;
+    animator.pool = nullptr;
+    record("renderShallow", 1, measure(settings, [&]() {
+        animator.animate(time += 1.0 / 120);
+        renderer.render(renderedTree);
+    }));
+    
+    // Also frees the animators installed on it.
+    delete tree;
+}
+
+static std::string toJson(const BenchSettings &settings, int threads, const std::vector<Measurement> &results) {
+    std::ostringstream json;
+    json << "{\n";
+    json << "  \"simd\": \"" << simdLevel() << "\",\n";
+    json << "  \"threads\": " << threads << ",\n";
+    json << "  \"repetitions\": " << settings.repetitions << ",\n";
+    json << "  \"peakRssBytes\": " << peakResidentBytes() << ",\n";
+    json << "  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Measurement &m = results[i];
+        json << (i == 0 ? "\n" : ",\n");
+        json << "    {\"name\": \"" << m.name << "\""
+             << ", \"depth\": " << m.depth
+             << ", \"fanOut\": " << m.fanOut
+             << ", \"nodes\": " << m.nodes
+             << ", \"threads\": " << m.threads
+             << ", \"medianNs\": " << (uint64_t)m.medianNs
+             << ", \"minNs\": " << (uint64_t)m.minNs
+             << ", \"nsPerNode\": " << m.medianNs / m.nodes
+             << ", \"nodesPerSecond\": " << (uint64_t)(m.nodes / (m.medianNs * 1e-9))
+             << ", \"allocations\": " << m.allocations
+             << ", \"allocatedBytes\": " << m.allocatedBytes
+             << ", \"peakRssBytes\": " << m.peakRss
+             << "}";
+    }
+    json << "\n  ]\n}\n";
+    return json.str();
+}
+
+//========================================================================
+int main(int argc, char *argv[]){
+    BenchSettings settings;
+    if (!settings.parse(argc, argv)) {
+        return 1;
+    }
+    ofSetRandomSeed(1);
+    
+    // The calling thread also works, so --threads 1 means no pool at all.
+    std::unique_ptr<ThreadPool> pool;
+    if (settings.threads != 1) {
+        pool.reset(new ThreadPool(max(settings.threads - 1, 0)));
+    }
+    
+    std::vector<Measurement> results;
+    for (int fanOut: settings.fanOuts) {
+        for (int depth = settings.minDepth; depth <= settings.maxDepth; depth++) {
+            // Counted in 64 bits first; nodeCount() is an int.
+            int64_t nodes = 1;
+            int64_t level = fanOut * 2;
+            for (int d = 1; d < depth && nodes <= settings.maxNodes; d++) {
+                nodes += level;
+                level *= fanOut;
+            }
+            if (fanOut < 1 || nodes > settings.maxNodes) {
+                fprintf(stderr, "skipping depth %d, fan-out %d\n", depth, fanOut);
+                continue;
+            }
+            fprintf(stderr, "depth %d, fan-out %d: %lld nodes\n", depth, fanOut, (long long)nodes);
+            benchTree(settings, pool.get(), depth, fanOut, results);
+        }
+    }
+    
+    std::string json = toJson(settings, pool == nullptr ? 1 : pool->workerCount() + 1, results);
+    if (settings.output.empty()) {
+        fputs(json.c_str(), stdout);
+    } else {
+        std::ofstream(settings.output) << json;
+    }
+    return allocationFailures > 0 || structureFailures > 0 ? 1 : 0;
+}
@@ -0,0 +1,258 @@
+//
+//  AnimationTrack.cpp
+//  CircleTree
+//
+
+#include "AnimationTrack.hpp"
+#include "TreeFile.hpp"
+#include "Trees.hpp"
+#include <string.h>
+#include <math.h>
+#include <fstream>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+static float *parameterField(TreeNodes &nodes, int field) {
+    float *fields[] = { nodes.aspect, nodes.branchAngle, nodes.terminusAngle, nodes.size, nodes.offset };
+    return fields[field];
+}
+
+// values = minimum + step * (from + (to - from) * fraction) over [begin, end),
+// four nodes at a time with SSE2 or NEON when the build targets them.
+static void interpolate(float *values, const float *minimum, const float *step, const uint16_t *from, const uint16_t *to, float fraction, int begin, int end) {
+    int node = begin;
+#if defined(__SSE2__)
+    __m128 weight = _mm_set1_ps(fraction);
+    __m128i zero = _mm_setzero_si128();
+    for (; node + 4 <= end; node += 4) {
+        __m128 a = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)(from + node)), zero));
+        __m128 b = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)(to + node)), zero));
+        __m128 quantized = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), weight));
+        _mm_storeu_ps(values + node, _mm_add_ps(_mm_loadu_ps(minimum + node), _mm_mul_ps(_mm_loadu_ps(step + node), quantized)));
+    }
+#elif defined(__ARM_NEON)
+    for (; node + 4 <= end; node += 4) {
+        float32x4_t a = vcvtq_f32_u32(vmovl_u16(vld1_u16(from + node)));
+        float32x4_t b = vcvtq_f32_u32(vmovl_u16(vld1_u16(to + node)));
+        float32x4_t quantized = vmlaq_n_f32(a, vsubq_f32(b, a), fraction);
+        vst1q_f32(values + node, vmlaq_f32(vld1q_f32(minimum + node), vld1q_f32(step + node), quantized));
+    }
+#endif
+    for (; node < end; node++) {
+        float quantized = from[node] + ((float)to[node] - from[node]) * fraction;
+        values[node] = minimum[node] + step[node] * quantized;
+    }
+}
+
+AnimationTrack::AnimationTrack():
+loop(false),
+fieldCount(0),
+ranges(nullptr),
+samples(nullptr)
+{}
+
+bool AnimationTrack::record(TreeAnimator &animator, const std::string &path, float startTime, float sampleRate, int sampleCount) {
+    if (sampleCount <= 0 || sampleRate <= 0) {
+        ofLogError("AnimationTrack") << "can't record " << sampleCount << " samples at " << sampleRate << " per second";
+        return false;
+    }
+    TreeNodes &nodes = animator.tree->nodes;
+    int count = nodes.count();
+    int stride = (count + 31) / 32 * 32;
+    TreeNodes initial = nodes;
+    
+    // First pass: the range of every value.
+    std::vector<float> minimum((size_t)parameterCount * stride, INFINITY);
+    std::vector<float> maximum((size_t)parameterCount * stride, -INFINITY);
+    for (int sample = 0; sample < sampleCount; sample++) {
+        animator.animate(startTime + sample / sampleRate);
+        for (int field = 0; field < parameterCount; field++) {
+            const float *values = parameterField(nodes, field);
+            float *low = minimum.data() + (size_t)field * stride;
+            float *high = maximum.data() + (size_t)field * stride;
+            for (int node = 0; node < count; node++) {
+                low[node] = min(low[node], values[node]);
+                high[node] = max(high[node], values[node]);
+            }
+        }
+    }
+    
+    AnimationTrackHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, animationTrackMagic, sizeof(header.magic));
+    header.version = AnimationTrackHeader::currentVersion;
+    header.byteOrder = TreeFileHeader::nativeByteOrder;
+    header.nodeCount = count;
+    header.stride = stride;
+    header.sampleCount = sampleCount;
+    header.startTime = startTime;
+    header.sampleRate = sampleRate;
+    
+    std::vector<int> fields;
+    for (int field = 0; field < parameterCount; field++) {
+        for (int node = 0; node < count; node++) {
+            if (maximum[(size_t)field * stride + node] > minimum[(size_t)field * stride + node]) {
+                header.fieldMask |= 1 << field;
+                fields.push_back(field);
+                break;
+            }
+        }
+    }
+    std::vector<float> ranges((size_t)fields.size() * 2 * stride, 0);
+    for (size_t i = 0; i < fields.size(); i++) {
+        const float *low = minimum.data() + (size_t)fields[i] * stride;
+        const float *high = maximum.data() + (size_t)fields[i] * stride;
+        float *rangeMinimum = ranges.data() + i * 2 * stride;
+        float *rangeStep = rangeMinimum + stride;
+        for (int node = 0; node < count; node++) {
+            rangeMinimum[node] = low[node];
+            rangeStep[node] = (high[node] - low[node]) / 65535;
+        }
+    }
+    header.rangesOffset = sizeof(AnimationTrackHeader);
+    header.samplesOffset = header.rangesOffset + ranges.size() * sizeof(float);
+    
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write((const char *)&header, sizeof(header));
+    file.write((const char *)ranges.data(), ranges.size() * sizeof(float));
+    
+    // Second pass: the same animation again, quantized against the ranges.
+    nodes = initial;
+    std::vector<uint16_t> sample((size_t)fields.size() * stride, 0);
+    for (int i = 0; i < sampleCount && file; i++) {
+        animator.animate(startTime + i / sampleRate);
+        for (size_t field = 0; field < fields.size(); field++) {
+            const float *values = parameterField(nodes, fields[field]);
+            const float *rangeMinimum = ranges.data() + field * 2 * stride;
+            const float *rangeStep = rangeMinimum + stride;
+            uint16_t *row = sample.data() + field * stride;
+            for (int node = 0; node < count; node++) {
+                float value = rangeStep[node] > 0 ? (values[node] - rangeMinimum[node]) / rangeStep[node] : 0;
+                row[node] = (uint16_t)ofClamp(value + 0.5f, 0, 65535);
+            }
+        }
+        file.write((const char *)sample.data(), sample.size() * sizeof(uint16_t));
+    }
+    nodes = initial;
+    
+    if (!file) {
+        ofLogError("AnimationTrack") << "couldn't write " << path;
+        return false;
+    }
+    return true;
+}
+
+AnimationTrack *AnimationTrack::open(const std::string &path) {
+    size_t length = 0;
+    std::shared_ptr<char> mapping = mapFile(path, length);
+    if (mapping == nullptr) {
+        return nullptr;
+    }
+    
+    AnimationTrackHeader header;
+    if (length < sizeof(header)) {
+        ofLogError("AnimationTrack") << path << " is too short for a track";
+        return nullptr;
+    }
+    memcpy(&header, mapping.get(), sizeof(header));
+    if (memcmp(header.magic, animationTrackMagic, sizeof(header.magic)) != 0) {
+        ofLogError("AnimationTrack") << path << " isn't a track";
+        return nullptr;
+    }
+    if (header.byteOrder != TreeFileHeader::nativeByteOrder) {
+        ofLogError("AnimationTrack") << path << " was written with another byte order";
+        return nullptr;
+    }
+    if (header.version != AnimationTrackHeader::currentVersion) {
+        ofLogError("AnimationTrack") << path << " is version " << header.version << "; this build reads version " << AnimationTrackHeader::currentVersion;
+        return nullptr;
+    }
+    
+    AnimationTrack *track = new AnimationTrack();
+    for (int field = 0; field < parameterCount; field++) {
+        if (header.fieldMask & (1 << field)) {
+            track->fields[track->fieldCount++] = field;
+        }
+    }
+    // A row is at most parameterCount * 2^32 samples, so neither it nor the
+    // ranges overflow; the sample count is bounded by the file before it
+    // multiplies a row, and offsets are compared by subtraction so they
+    // can't wrap either.
+    size_t rowBytes = (size_t)track->fieldCount * header.stride * sizeof(uint16_t);
+    size_t rangesBytes = (size_t)track->fieldCount * 2 * header.stride * sizeof(float);
+    if (header.stride % 32 != 0 || header.nodeCount > header.stride ||
+        header.fieldMask >= 1u << parameterCount || header.sampleCount == 0 || !(header.sampleRate > 0) ||
+        (rowBytes > 0 && header.sampleCount > length / rowBytes) ||
+        header.rangesOffset % 64 != 0 || header.samplesOffset % 64 != 0 ||
+        header.rangesOffset > length || rangesBytes > length - header.rangesOffset ||
+        header.samplesOffset > length || header.sampleCount * rowBytes > length - header.samplesOffset) {
+        ofLogError("AnimationTrack") << path << " is truncated or its layout doesn't match this build";
+        delete track;
+        return nullptr;
+    }
+#ifndef _WIN32
+    // Playback moves forward through the samples.
+    madvise(mapping.get(), length, MADV_SEQUENTIAL);
+#endif
+    
+    track->mapping = mapping;
+    track->header = header;
+    track->ranges = (const float *)(mapping.get() + header.rangesOffset);
+    track->samples = (const uint16_t *)(mapping.get() + header.samplesOffset);
+    for (int node = 0; node < (int)header.nodeCount; node++) {
+        for (int field = 0; field < track->fieldCount; field++) {
+            if (track->ranges[((size_t)field * 2 + 1) * header.stride + node] != 0) {
+                track->movingNodes.push_back(node);
+                break;
+            }
+        }
+    }
+    return track;
+}
+
+void AnimationTrack::apply(TreeNodes &nodes, float time, ThreadPool *pool, int grainSize) const {
+    int count = min((int)header.nodeCount, nodes.count());
+    int last = header.sampleCount - 1;
+    float position = (time - header.startTime) * header.sampleRate;
+    if (loop && last > 0) {
+        position = fmodf(position, last);
+        if (position < 0) {
+            position += last;
+        }
+    }
+    position = ofClamp(position, 0, last);
+    int first = min((int)position, max(last - 1, 0));
+    int second = min(first + 1, last);
+    float fraction = position - first;
+    
+    auto range = [&](int begin, int end) {
+        for (int field = 0; field < fieldCount; field++) {
+            float *values = parameterField(nodes, fields[field]);
+            const float *rangeMinimum = ranges + (size_t)field * 2 * header.stride;
+            const float *rangeStep = rangeMinimum + header.stride;
+            const uint16_t *from = samples + ((size_t)first * fieldCount + field) * header.stride;
+            const uint16_t *to = samples + ((size_t)second * fieldCount + field) * header.stride;
+            interpolate(values, rangeMinimum, rangeStep, from, to, fraction, begin, end);
+        }
+    };
+    if (pool == nullptr) {
+        range(0, count);
+    } else {
+        pool->parallelFor(0, count, grainSize, range);
+    }
+    
+    for (int node: movingNodes) {
+        if (node >= count) {
+            break;
+        }
+        nodes.touch(node);
+    }
+}
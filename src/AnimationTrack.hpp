@@ -0,0 +1,106 @@
+//
+//  AnimationTrack.hpp
+//  CircleTree
+//
+
+#ifndef AnimationTrack_hpp
+#define AnimationTrack_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ThreadPool.hpp"
+
+struct TreeNodes;
+class TreeAnimator;
+
+// The on-disk track written by AnimationTrack::record, in the writer's byte
+// order like a TreeFile:
+//
+//     AnimationTrackHeader                 64 bytes
+//     ranges                               at rangesOffset
+//     samples[sampleCount]                 at samplesOffset
+//
+// Only the BranchParameters fields that change during the recording are
+// stored; bit i of fieldMask is set when the ith field, in declaration
+// order, is. Per stored field, ranges holds a row of minimums and then a row
+// of steps, and each sample holds a row of uint16_t values, so a node's value
+// is minimum + step * value. Rows are stride elements long, nodeCount
+// rounded up to 32, which keeps every row 64-byte aligned.
+struct AnimationTrackHeader {
+    static constexpr uint32_t currentVersion = 1;
+    
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t nodeCount;
+    uint32_t stride;
+    uint32_t sampleCount;
+    uint32_t fieldMask;
+    float startTime;
+    float sampleRate;
+    uint64_t rangesOffset;
+    uint64_t samplesOffset;
+    uint32_t reserved[2];
+};
+
+static_assert(sizeof(AnimationTrackHeader) == 64, "AnimationTrackHeader is 64 bytes");
+
+static const char animationTrackMagic[8] = { 'C', 'T', 'R', 'A', 'C', 'K', '\r', '\n' };
+
+// Baked animation for one tree, played from a mapped track file. Each node's
+// values are read from the two samples around the time and interpolated, so
+// playback costs the same whatever the animators that made it cost, and
+// pages of samples are read from disk only as playback reaches them.
+class AnimationTrack {
+public:
+    // When set, times past the last sample wrap around to the first.
+    bool loop;
+    
+    // Samples the animator's tree after animating it to each of sampleCount
+    // times, sampleRate apart from startTime, and writes them to path. The
+    // tree is animated through the recording twice, to find each value's
+    // range and then to quantize it, and is left as it was found. Returns
+    // false, logging why, on failure.
+    static bool record(TreeAnimator &animator, const std::string &path, float startTime, float sampleRate, int sampleCount);
+    // Maps a track. Returns nullptr, logging why, when the file is missing
+    // or not a track of this version.
+    static AnimationTrack *open(const std::string &path);
+    
+    int nodeCount() const {
+        return header.nodeCount;
+    }
+    
+    int sampleCount() const {
+        return header.sampleCount;
+    }
+    
+    // From the first sample to the last.
+    float duration() const {
+        return (header.sampleCount - 1) / header.sampleRate;
+    }
+    
+    // Sets the stored fields of the recorded nodes to their values at time
+    // and touches the nodes that move. Splits the nodes across the pool, if
+    // there is one, in chunks of at least grainSize.
+    void apply(TreeNodes &nodes, float time, ThreadPool *pool = nullptr, int grainSize = 16384) const;
+    
+private:
+    static const int parameterCount = 5;
+    
+    std::shared_ptr<char> mapping;
+    AnimationTrackHeader header;
+    // The stored fields, by index into BranchParameters.
+    int fields[parameterCount];
+    int fieldCount;
+    const float *ranges;
+    const uint16_t *samples;
+    // Nodes with a nonzero step in some stored field.
+    std::vector<int> movingNodes;
+    
+    AnimationTrack();
+};
+
+#endif /* AnimationTrack_hpp */
@@ -0,0 +1,255 @@
+//
+//  AnimatorKernels.cpp
+//  CircleTree
+//
+
+#include "AnimatorKernels.hpp"
+#include <math.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Range reduction subtracts k * 2pi in two parts so large arguments (drifting
+// angles feed v straight into the sine) keep their precision. The reduced
+// r in [-pi, pi] is folded to f = min(|r|, pi - |r|), where
+// sin(r) = sign(r) * sin(f), and sin(f) is a degree 9 Taylor polynomial.
+// Rounding can leave |r| a hair past pi, making f slightly negative, so the
+// sign is flipped rather than copied.
+static const float inverseTwoPi = 0.159154943091895f;
+static const float twoPiHigh = 6.28125f;
+static const float twoPiLow = 0.00193530717958647f;
+static const float pi = 3.14159265358979f;
+static const float sin3 = -1.0f / 6.0f;
+static const float sin5 = 1.0f / 120.0f;
+static const float sin7 = -1.0f / 5040.0f;
+static const float sin9 = 1.0f / 362880.0f;
+
+AnimatorChannel::AnimatorChannel():
+valueGain(1),
+bias(0),
+amplitude(0),
+timeFrequency(0),
+valueFrequency(0),
+phase(0),
+sqrtTime(false)
+{}
+
+AnimatorChannel AnimatorChannel::constant() {
+    return AnimatorChannel();
+}
+
+AnimatorChannel AnimatorChannel::drift(float rate) {
+    AnimatorChannel channel;
+    channel.bias = rate;
+    return channel;
+}
+
+AnimatorChannel AnimatorChannel::sine(float bias, float amplitude, float timeFrequency, float valueFrequency, float phase) {
+    AnimatorChannel channel;
+    channel.valueGain = 0;
+    channel.bias = bias;
+    channel.amplitude = amplitude;
+    channel.timeFrequency = timeFrequency;
+    channel.valueFrequency = valueFrequency;
+    channel.phase = phase;
+    return channel;
+}
+
+AnimatorChannel AnimatorChannel::cosine(float bias, float amplitude, float timeFrequency, float valueFrequency, float phase) {
+    return sine(bias, amplitude, timeFrequency, valueFrequency, phase + pi / 2);
+}
+
+AnimatorChannel AnimatorChannel::ofSqrtTime() const {
+    AnimatorChannel channel = *this;
+    channel.sqrtTime = true;
+    return channel;
+}
+
+float AnimatorChannel::evaluate(float v, float t) const {
+    float x = v;
+    animateChannelScalar(*this, &x, 1, t);
+    return x;
+}
+
+float fastSin(float x) {
+    float k = nearbyintf(x * inverseTwoPi);
+    float r = (x - k * twoPiHigh) - k * twoPiLow;
+    float a = fabsf(r);
+    float f = fminf(a, pi - a);
+    float f2 = f * f;
+    float p = sin9;
+    p = p * f2 + sin7;
+    p = p * f2 + sin5;
+    p = p * f2 + sin3;
+    p = p * f2 * f + f;
+    return r < 0 ? -p : p;
+}
+
+void animateChannelScalar(const AnimatorChannel &channel, float *values, int count, float t) {
+    float time = channel.sqrtTime ? sqrtf(t) : t;
+    float timePhase = channel.timeFrequency * time + channel.phase;
+    for (int i = 0; i < count; i++) {
+        float v = values[i];
+        values[i] = channel.valueGain * v + channel.bias + channel.amplitude * fastSin(channel.valueFrequency * v + timePhase);
+    }
+}
+
+#if defined(__AVX2__)
+
+static inline __m256 fastSin8(__m256 x) {
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    __m256 k = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(inverseTwoPi)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_sub_ps(x, _mm256_mul_ps(k, _mm256_set1_ps(twoPiHigh)));
+    r = _mm256_sub_ps(r, _mm256_mul_ps(k, _mm256_set1_ps(twoPiLow)));
+    __m256 sign = _mm256_and_ps(r, signMask);
+    __m256 a = _mm256_andnot_ps(signMask, r);
+    __m256 f = _mm256_min_ps(a, _mm256_sub_ps(_mm256_set1_ps(pi), a));
+    __m256 f2 = _mm256_mul_ps(f, f);
+    __m256 p = _mm256_set1_ps(sin9);
+    p = _mm256_add_ps(_mm256_mul_ps(p, f2), _mm256_set1_ps(sin7));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f2), _mm256_set1_ps(sin5));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f2), _mm256_set1_ps(sin3));
+    p = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(p, f2), f), f);
+    return _mm256_xor_ps(p, sign);
+}
+
+void animateChannel(const AnimatorChannel &channel, float *values, int count, float t) {
+    float time = channel.sqrtTime ? sqrtf(t) : t;
+    __m256 gain = _mm256_set1_ps(channel.valueGain);
+    __m256 bias = _mm256_set1_ps(channel.bias);
+    __m256 amplitude = _mm256_set1_ps(channel.amplitude);
+    __m256 valueFrequency = _mm256_set1_ps(channel.valueFrequency);
+    __m256 timePhase = _mm256_set1_ps(channel.timeFrequency * time + channel.phase);
+    
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 v = _mm256_loadu_ps(values + i);
+        __m256 s = fastSin8(_mm256_add_ps(_mm256_mul_ps(valueFrequency, v), timePhase));
+        __m256 result = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(gain, v), bias), _mm256_mul_ps(amplitude, s));
+        _mm256_storeu_ps(values + i, result);
+    }
+    animateChannelScalar(channel, values + i, count - i, t);
+}
+
+void fastSinInPlace(float *values, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(values + i, fastSin8(_mm256_loadu_ps(values + i)));
+    }
+    for (; i < count; i++) {
+        values[i] = fastSin(values[i]);
+    }
+}
+
+#elif defined(__SSE2__)
+
+static inline __m128 fastSin4(__m128 x) {
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    __m128 k = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(inverseTwoPi))));
+    __m128 r = _mm_sub_ps(x, _mm_mul_ps(k, _mm_set1_ps(twoPiHigh)));
+    r = _mm_sub_ps(r, _mm_mul_ps(k, _mm_set1_ps(twoPiLow)));
+    __m128 sign = _mm_and_ps(r, signMask);
+    __m128 a = _mm_andnot_ps(signMask, r);
+    __m128 f = _mm_min_ps(a, _mm_sub_ps(_mm_set1_ps(pi), a));
+    __m128 f2 = _mm_mul_ps(f, f);
+    __m128 p = _mm_set1_ps(sin9);
+    p = _mm_add_ps(_mm_mul_ps(p, f2), _mm_set1_ps(sin7));
+    p = _mm_add_ps(_mm_mul_ps(p, f2), _mm_set1_ps(sin5));
+    p = _mm_add_ps(_mm_mul_ps(p, f2), _mm_set1_ps(sin3));
+    p = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, f2), f), f);
+    return _mm_xor_ps(p, sign);
+}
+
+void animateChannel(const AnimatorChannel &channel, float *values, int count, float t) {
+    float time = channel.sqrtTime ? sqrtf(t) : t;
+    __m128 gain = _mm_set1_ps(channel.valueGain);
+    __m128 bias = _mm_set1_ps(channel.bias);
+    __m128 amplitude = _mm_set1_ps(channel.amplitude);
+    __m128 valueFrequency = _mm_set1_ps(channel.valueFrequency);
+    __m128 timePhase = _mm_set1_ps(channel.timeFrequency * time + channel.phase);
+    
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 v = _mm_loadu_ps(values + i);
+        __m128 s = fastSin4(_mm_add_ps(_mm_mul_ps(valueFrequency, v), timePhase));
+        __m128 result = _mm_add_ps(_mm_add_ps(_mm_mul_ps(gain, v), bias), _mm_mul_ps(amplitude, s));
+        _mm_storeu_ps(values + i, result);
+    }
+    animateChannelScalar(channel, values + i, count - i, t);
+}
+
+void fastSinInPlace(float *values, int count) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(values + i, fastSin4(_mm_loadu_ps(values + i)));
+    }
+    for (; i < count; i++) {
+        values[i] = fastSin(values[i]);
+    }
+}
+
+#elif defined(__ARM_NEON)
+
+static inline float32x4_t fastSin4(float32x4_t x) {
+    const uint32x4_t signMask = vdupq_n_u32(0x80000000);
+    float32x4_t k = vcvtq_f32_s32(vcvtnq_s32_f32(vmulq_n_f32(x, inverseTwoPi)));
+    float32x4_t r = vsubq_f32(x, vmulq_n_f32(k, twoPiHigh));
+    r = vsubq_f32(r, vmulq_n_f32(k, twoPiLow));
+    uint32x4_t sign = vandq_u32(vreinterpretq_u32_f32(r), signMask);
+    float32x4_t a = vabsq_f32(r);
+    float32x4_t f = vminq_f32(a, vsubq_f32(vdupq_n_f32(pi), a));
+    float32x4_t f2 = vmulq_f32(f, f);
+    float32x4_t p = vdupq_n_f32(sin9);
+    p = vaddq_f32(vmulq_f32(p, f2), vdupq_n_f32(sin7));
+    p = vaddq_f32(vmulq_f32(p, f2), vdupq_n_f32(sin5));
+    p = vaddq_f32(vmulq_f32(p, f2), vdupq_n_f32(sin3));
+    p = vaddq_f32(vmulq_f32(vmulq_f32(p, f2), f), f);
+    return vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(p), sign));
+}
+
+void animateChannel(const AnimatorChannel &channel, float *values, int count, float t) {
+    float time = channel.sqrtTime ? sqrtf(t) : t;
+    float32x4_t gain = vdupq_n_f32(channel.valueGain);
+    float32x4_t bias = vdupq_n_f32(channel.bias);
+    float32x4_t amplitude = vdupq_n_f32(channel.amplitude);
+    float32x4_t valueFrequency = vdupq_n_f32(channel.valueFrequency);
+    float32x4_t timePhase = vdupq_n_f32(channel.timeFrequency * time + channel.phase);
+    
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t v = vld1q_f32(values + i);
+        float32x4_t s = fastSin4(vaddq_f32(vmulq_f32(valueFrequency, v), timePhase));
+        float32x4_t result = vaddq_f32(vaddq_f32(vmulq_f32(gain, v), bias), vmulq_f32(amplitude, s));
+        vst1q_f32(values + i, result);
+    }
+    animateChannelScalar(channel, values + i, count - i, t);
+}
+
+void fastSinInPlace(float *values, int count) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        vst1q_f32(values + i, fastSin4(vld1q_f32(values + i)));
+    }
+    for (; i < count; i++) {
+        values[i] = fastSin(values[i]);
+    }
+}
+
+#else
+
+void animateChannel(const AnimatorChannel &channel, float *values, int count, float t) {
+    animateChannelScalar(channel, values, count, t);
+}
+
+void fastSinInPlace(float *values, int count) {
+    for (int i = 0; i < count; i++) {
+        values[i] = fastSin(values[i]);
+    }
+}
+
+#endif
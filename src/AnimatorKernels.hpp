@@ -0,0 +1,67 @@
+//
+//  AnimatorKernels.hpp
+//  CircleTree
+//
+
+#ifndef AnimatorKernels_hpp
+#define AnimatorKernels_hpp
+
+#include <stdio.h>
+
+// One animated BranchParameters channel in a closed form that can be
+// evaluated over many nodes at once:
+//
+//     v' = valueGain * v + bias + amplitude * sin(timeFrequency * t' + valueFrequency * v + phase)
+//
+// where t' is the animation time, or its square root when sqrtTime is set.
+// This covers constant channels, linear drift (v + rate) and the sine/cosine
+// lambdas in ofApp::setup.
+struct AnimatorChannel {
+public:
+    float valueGain;
+    float bias;
+    float amplitude;
+    float timeFrequency;
+    float valueFrequency;
+    float phase;
+    bool sqrtTime;
+    
+    AnimatorChannel();
+    
+    static AnimatorChannel constant();
+    static AnimatorChannel drift(float rate);
+    static AnimatorChannel sine(float bias, float amplitude, float timeFrequency, float valueFrequency = 0, float phase = 0);
+    static AnimatorChannel cosine(float bias, float amplitude, float timeFrequency, float valueFrequency = 0, float phase = 0);
+    
+    AnimatorChannel ofSqrtTime() const;
+    
+    // Channels that leave every value untouched can be skipped entirely.
+    bool isConstant() const {
+        return valueGain == 1 && bias == 0 && amplitude == 0;
+    }
+    
+    // Channels that ignore v give every node the same value, so it can be
+    // evaluated once and broadcast.
+    bool isTimeOnly() const {
+        return valueGain == 0 && (valueFrequency == 0 || amplitude == 0);
+    }
+    
+    float evaluate(float v, float t) const;
+};
+
+// sin(x) with the same range reduction and polynomial the vector kernels
+// use. Absolute error is below 1e-5 for |x| up to about 1e4.
+float fastSin(float x);
+
+// Replaces each of count values with its fastSin, with the same vector paths
+// as animateChannel.
+void fastSinInPlace(float *values, int count);
+
+// Evaluates a channel in place over count contiguous values, using AVX2,
+// SSE2 or NEON when the build targets them and the scalar path otherwise.
+void animateChannel(const AnimatorChannel &channel, float *values, int count, float t);
+
+// The portable path, kept callable so the vector paths can be checked against it.
+void animateChannelScalar(const AnimatorChannel &channel, float *values, int count, float t);
+
+#endif /* AnimatorKernels_hpp */
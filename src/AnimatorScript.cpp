@@ -0,0 +1,645 @@
+//
+//  AnimatorScript.cpp
+//  CircleTree
+//
+
+#include "AnimatorScript.hpp"
+#include "AnimatorKernels.hpp"
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+static const float pi = 3.14159265358979f;
+
+// Recursive descent over
+//
+//     sum     = product (('+' | '-') product)*
+//     product = unary (('*' | '/') unary)*
+//     unary   = '-' unary | primary
+//     primary = number | 'v' | 'd' | 'pi' | name '(' sum (',' sum)* ')' | '(' sum ')'
+//
+// into a tree of nodes, then emitted bottom up. Every parse function returns
+// a node index, or -1 once error is set.
+struct AnimatorExpression::Parser {
+    struct Node {
+        Opcode opcode;
+        int left;
+        int right;
+        float value;
+        bool usesValue;
+        bool usesTime;
+    };
+    
+    const std::string &source;
+    size_t position;
+    std::string error;
+    std::vector<Node> nodes;
+    
+    Parser(const std::string &source): source(source), position(0) {}
+    
+    int fail(const std::string &message) {
+        if (error.empty()) {
+            error = message + " at column " + std::to_string(position + 1);
+        }
+        return -1;
+    }
+    
+    void skipSpace() {
+        while (position < source.size() && isspace((unsigned char)source[position])) {
+            position++;
+        }
+    }
+    
+    bool accept(char c) {
+        skipSpace();
+        if (position < source.size() && source[position] == c) {
+            position++;
+            return true;
+        }
+        return false;
+    }
+    
+    int leaf(Opcode opcode, float value) {
+        nodes.push_back({ opcode, -1, -1, value, opcode == Value, opcode == Time });
+        return (int)nodes.size() - 1;
+    }
+    
+    static bool isBinary(Opcode opcode) {
+        return (opcode >= Add && opcode <= ReverseDivide) || opcode >= Min;
+    }
+    
+    // The scalar meaning of an operation, for folding constants.
+    static float fold(Opcode opcode, float a, float b) {
+        switch (opcode) {
+            case Add: return a + b;
+            case Subtract: return a - b;
+            case Multiply: return a * b;
+            case Divide: return a / b;
+            case Negate: return -a;
+            case Sin: return fastSin(a);
+            case Cos: return fastSin(a + pi / 2);
+            case Sqrt: return sqrtf(a);
+            case Abs: return fabsf(a);
+            case Floor: return floorf(a);
+            case Min: return fminf(a, b);
+            case Max: return fmaxf(a, b);
+            case Pow: return powf(a, b);
+            default: return a;
+        }
+    }
+    
+    // Folds operations on constants as they are made.
+    int operation(Opcode opcode, int left, int right = -1) {
+        if (left < 0 || (isBinary(opcode) && right < 0)) {
+            return -1;
+        }
+        bool usesValue = nodes[left].usesValue || (right >= 0 && nodes[right].usesValue);
+        bool usesTime = nodes[left].usesTime || (right >= 0 && nodes[right].usesTime);
+        if (!usesValue && !usesTime) {
+            return leaf(Constant, fold(opcode, nodes[left].value, right >= 0 ? nodes[right].value : 0));
+        }
+        nodes.push_back({ opcode, left, right, 0, usesValue, usesTime });
+        return (int)nodes.size() - 1;
+    }
+    
+    int parseSum() {
+        int node = parseProduct();
+        while (node >= 0) {
+            if (accept('+')) {
+                node = operation(Add, node, parseProduct());
+            } else if (accept('-')) {
+                node = operation(Subtract, node, parseProduct());
+            } else {
+                break;
+            }
+        }
+        return node;
+    }
+    
+    int parseProduct() {
+        int node = parseUnary();
+        while (node >= 0) {
+            if (accept('*')) {
+                node = operation(Multiply, node, parseUnary());
+            } else if (accept('/')) {
+                node = operation(Divide, node, parseUnary());
+            } else {
+                break;
+            }
+        }
+        return node;
+    }
+    
+    int parseUnary() {
+        if (accept('-')) {
+            return operation(Negate, parseUnary());
+        }
+        return parsePrimary();
+    }
+    
+    int parsePrimary() {
+        skipSpace();
+        if (position >= source.size()) {
+            return fail("expected a value");
+        }
+        char c = source[position];
+        if (isdigit((unsigned char)c) || c == '.') {
+            const char *start = source.c_str() + position;
+            char *end = nullptr;
+            float value = strtof(start, &end);
+            if (end == start) {
+                return fail("bad number");
+            }
+            position += end - start;
+            return leaf(Constant, value);
+        }
+        if (accept('(')) {
+            int node = parseSum();
+            if (node >= 0 && !accept(')')) {
+                return fail("expected ')'");
+            }
+            return node;
+        }
+        if (!isalpha((unsigned char)c)) {
+            return fail(std::string("unexpected '") + c + "'");
+        }
+        size_t start = position;
+        while (position < source.size() && isalnum((unsigned char)source[position])) {
+            position++;
+        }
+        std::string name = source.substr(start, position - start);
+        if (name == "v") {
+            return leaf(Value, 0);
+        } else if (name == "d") {
+            return leaf(Time, 0);
+        } else if (name == "pi") {
+            return leaf(Constant, pi);
+        }
+        
+        struct Function {
+            const char *name;
+            Opcode opcode;
+            int arity;
+        };
+        static const Function functions[] = {
+            { "sin", Sin, 1 }, { "cos", Cos, 1 }, { "sqrt", Sqrt, 1 }, { "abs", Abs, 1 },
+            { "floor", Floor, 1 }, { "min", Min, 2 }, { "max", Max, 2 }, { "pow", Pow, 2 }
+        };
+        const Function *function = nullptr;
+        for (const Function &candidate: functions) {
+            if (name == candidate.name) {
+                function = &candidate;
+            }
+        }
+        if (function == nullptr) {
+            position = start;
+            return fail("unknown name '" + name + "'");
+        }
+        if (!accept('(')) {
+            return fail("expected '(' after " + name);
+        }
+        int arguments[2] = { -1, -1 };
+        for (int i = 0; i < function->arity; i++) {
+            if (i > 0 && !accept(',')) {
+                return fail(name + " takes " + std::to_string(function->arity) + " arguments");
+            }
+            arguments[i] = parseSum();
+            if (arguments[i] < 0) {
+                return -1;
+            }
+        }
+        if (!accept(')')) {
+            return fail("expected ')' after " + name + "'s arguments");
+        }
+        return operation(function->opcode, arguments[0], arguments[1]);
+    }
+    
+    bool fits(int depth) {
+        if (depth > maxStackDepth) {
+            fail("expression needs more than " + std::to_string(maxStackDepth) + " stack slots");
+            return false;
+        }
+        return true;
+    }
+    
+    // Makes a node without v a scalar operand: a constant, or the result of
+    // its own code in the uniform program.
+    bool reference(int node, AnimatorExpression &expression, Source &source, uint16_t &operand) {
+        if (nodes[node].opcode == Constant) {
+            if (expression.constants.size() >= UINT16_MAX) {
+                fail("too many constants");
+                return false;
+            }
+            source = Constants;
+            operand = (uint16_t)expression.constants.size();
+            expression.constants.push_back(nodes[node].value);
+            return true;
+        }
+        if (expression.uniformCount >= maxUniforms) {
+            fail("more than " + std::to_string(maxUniforms) + " subexpressions of d");
+            return false;
+        }
+        if (!emit(node, expression, expression.uniformCode, 0)) {
+            return false;
+        }
+        source = Uniforms;
+        operand = (uint16_t)expression.uniformCount++;
+        expression.uniformCode.push_back({ Store, Uniforms, operand });
+        return true;
+    }
+    
+    // Appends node's code to code, which has depth values on its stack
+    // already. When emitting the varying program, nodes without v become
+    // scalar operands.
+    bool emit(int node, AnimatorExpression &expression, std::vector<Instruction> &code, int depth) {
+        if (!fits(depth + 1)) {
+            return false;
+        }
+        const Node &n = nodes[node];
+        bool varying = &code == &expression.code;
+        Source source = Stack;
+        uint16_t operand = 0;
+        if (n.opcode == Constant || (varying && !n.usesValue)) {
+            if (!reference(node, expression, source, operand)) {
+                return false;
+            }
+            code.push_back({ Load, source, operand });
+            return true;
+        }
+        if (n.opcode == Value || n.opcode == Time) {
+            code.push_back({ n.opcode, Stack, 0 });
+            return true;
+        }
+        if (n.right < 0) {
+            if (!emit(n.left, expression, code, depth)) {
+                return false;
+            }
+            code.push_back({ n.opcode, Stack, 0 });
+            return true;
+        }
+        
+        int left = n.left;
+        int right = n.right;
+        Opcode opcode = n.opcode;
+        if (varying && !nodes[left].usesValue && opcode != Pow) {
+            std::swap(left, right);
+            if (opcode == Subtract) {
+                opcode = ReverseSubtract;
+            } else if (opcode == Divide) {
+                opcode = ReverseDivide;
+            }
+        }
+        if (!emit(left, expression, code, depth)) {
+            return false;
+        }
+        if (varying && !nodes[right].usesValue) {
+            if (!reference(right, expression, source, operand)) {
+                return false;
+            }
+        } else if (!emit(right, expression, code, depth + 1)) {
+            return false;
+        }
+        code.push_back({ opcode, source, operand });
+        return true;
+    }
+};
+
+AnimatorExpression::AnimatorExpression():
+text("v"),
+code({ { Value, Stack, 0 } }),
+uniformCount(0),
+usesValue(true)
+{}
+
+bool AnimatorExpression::compile(const std::string &source, AnimatorExpression &expression, std::string &error) {
+    Parser parser(source);
+    int root = parser.parseSum();
+    parser.skipSpace();
+    if (root >= 0 && parser.position < source.size()) {
+        parser.fail(std::string("unexpected '") + source[parser.position] + "'");
+    }
+    AnimatorExpression compiled;
+    compiled.text = source;
+    compiled.code.clear();
+    compiled.usesValue = root >= 0 && parser.nodes[root].usesValue;
+    if (parser.error.empty()) {
+        parser.emit(root, compiled, compiled.code, 0);
+    }
+    if (!parser.error.empty()) {
+        error = parser.error;
+        return false;
+    }
+    expression = compiled;
+    return true;
+}
+
+bool AnimatorExpression::isIdentity() const {
+    return code.size() == 1 && code[0].opcode == Value;
+}
+
+float AnimatorExpression::evaluate(float v, float t) const {
+    evaluate(&v, 1, t);
+    return v;
+}
+
+void AnimatorExpression::evaluate(float *values, int count, float t) const {
+    float uniforms[maxUniforms];
+    float scalars[maxStackDepth];
+    run(uniformCode, constants.data(), uniforms, nullptr, t, scalars, 1, 1);
+    if (count == 1) {
+        run(code, constants.data(), uniforms, values, t, scalars, 1, 1);
+        values[0] = scalars[0];
+        return;
+    }
+    alignas(64) float stack[maxStackDepth * laneCount];
+    for (int begin = 0; begin < count; begin += laneCount) {
+        int lanes = min(laneCount, count - begin);
+        run(code, constants.data(), uniforms, values + begin, t, stack, laneCount, lanes);
+        std::copy(stack, stack + lanes, values + begin);
+    }
+}
+
+// a = operation(a, b) over count values, with b a scalar when given one.
+template <typename Operation>
+static inline void combine(float *a, const float *b, const float *scalar, int count, Operation operation) {
+    if (scalar != nullptr) {
+        float value = *scalar;
+        for (int i = 0; i < count; i++) {
+            a[i] = operation(a[i], value);
+        }
+    } else {
+        for (int i = 0; i < count; i++) {
+            a[i] = operation(a[i], b[i]);
+        }
+    }
+}
+
+// Stack slot i is stride floats at stack + i * stride, of which the first
+// count are live. Every instruction is one loop over them, which the
+// compiler can vectorize; sin and cos use the vector fastSin.
+void AnimatorExpression::run(const std::vector<Instruction> &code, const float *constants, float *uniforms, const float *values, float t, float *stack, int stride, int count) {
+    int depth = 0;
+    for (const Instruction &instruction: code) {
+        float *top = stack + (depth - 1) * stride;
+        float *next = top + stride;
+        const float *scalar = nullptr;
+        if (instruction.source == Constants) {
+            scalar = constants + instruction.operand;
+        } else if (instruction.source == Uniforms) {
+            scalar = uniforms + instruction.operand;
+        }
+        switch (instruction.opcode) {
+            case Value:
+                std::copy(values, values + count, next);
+                depth++;
+                break;
+            case Time:
+                std::fill(next, next + count, t);
+                depth++;
+                break;
+            case Load:
+                std::fill(next, next + count, *scalar);
+                depth++;
+                break;
+            case Store:
+                uniforms[instruction.operand] = top[0];
+                depth--;
+                break;
+            case Negate:
+                for (int i = 0; i < count; i++) {
+                    top[i] = -top[i];
+                }
+                break;
+            case Sin:
+                fastSinInPlace(top, count);
+                break;
+            case Cos:
+                for (int i = 0; i < count; i++) {
+                    top[i] += pi / 2;
+                }
+                fastSinInPlace(top, count);
+                break;
+            case Sqrt:
+                for (int i = 0; i < count; i++) {
+                    top[i] = sqrtf(top[i]);
+                }
+                break;
+            case Abs:
+                for (int i = 0; i < count; i++) {
+                    top[i] = fabsf(top[i]);
+                }
+                break;
+            case Floor:
+                for (int i = 0; i < count; i++) {
+                    top[i] = floorf(top[i]);
+                }
+                break;
+            default: {
+                // With the operand on the stack, the result goes in the
+                // slot below it.
+                float *a = scalar != nullptr ? top : top - stride;
+                switch (instruction.opcode) {
+                    case Add:
+                        combine(a, top, scalar, count, [](float x, float y) { return x + y; });
+                        break;
+                    case Subtract:
+                        combine(a, top, scalar, count, [](float x, float y) { return x - y; });
+                        break;
+                    case Multiply:
+                        combine(a, top, scalar, count, [](float x, float y) { return x * y; });
+                        break;
+                    case Divide:
+                        combine(a, top, scalar, count, [](float x, float y) { return x / y; });
+                        break;
+                    case ReverseSubtract:
+                        combine(a, top, scalar, count, [](float x, float y) { return y - x; });
+                        break;
+                    case ReverseDivide:
+                        combine(a, top, scalar, count, [](float x, float y) { return y / x; });
+                        break;
+                    case Min:
+                        combine(a, top, scalar, count, [](float x, float y) { return fminf(x, y); });
+                        break;
+                    case Max:
+                        combine(a, top, scalar, count, [](float x, float y) { return fmaxf(x, y); });
+                        break;
+                    case Pow:
+                        combine(a, top, scalar, count, [](float x, float y) { return powf(x, y); });
+                        break;
+                    default:
+                        break;
+                }
+                if (scalar == nullptr) {
+                    depth--;
+                }
+                break;
+            }
+        }
+    }
+}
+
+ScriptedNodeAnimator::ScriptedNodeAnimator():
+NodeAnimator(NodeAnimatorFunctions())
+{}
+
+static float *parameterField(TreeNodes &nodes, int field) {
+    float *fields[] = { nodes.aspect, nodes.branchAngle, nodes.terminusAngle, nodes.size, nodes.offset };
+    return fields[field];
+}
+
+void ScriptedNodeAnimator::applyTo(TreeNodes &nodes, int node, float dt) {
+    for (int field = 0; field < 5; field++) {
+        if (!expressions[field].isIdentity()) {
+            float &value = parameterField(nodes, field)[node];
+            value = expressions[field].evaluate(value, dt);
+        }
+    }
+}
+
+// As NodeAnimator's channels: gathered into scratch, evaluated there in
+// blocks and scattered back.
+void ScriptedNodeAnimator::applyTo(TreeNodes &nodes, const int *group, int count, float *scratch, float dt) {
+    for (int field = 0; field < 5; field++) {
+        const AnimatorExpression &expression = expressions[field];
+        float *values = parameterField(nodes, field);
+        if (expression.isIdentity()) {
+            continue;
+        }
+        if (expression.isTimeOnly()) {
+            float value = expression.evaluate(0, dt);
+            for (int i = 0; i < count; i++) {
+                values[group[i]] = value;
+            }
+            continue;
+        }
+        for (int i = 0; i < count; i++) {
+            scratch[i] = values[group[i]];
+        }
+        expression.evaluate(scratch, count, dt);
+        for (int i = 0; i < count; i++) {
+            values[group[i]] = scratch[i];
+        }
+    }
+}
+
+void ScriptedNodeAnimator::applyTo(float *const *fields, int count, float dt) {
+    for (int field = 0; field < 5; field++) {
+        const AnimatorExpression &expression = expressions[field];
+        if (expression.isIdentity()) {
+            continue;
+        }
+        if (expression.isTimeOnly()) {
+            std::fill(fields[field], fields[field] + count, expression.evaluate(0, dt));
+            continue;
+        }
+        expression.evaluate(fields[field], count, dt);
+    }
+}
+
+bool ScriptedNodeAnimator::isStatic() const {
+    for (const AnimatorExpression &expression: expressions) {
+        if (!expression.isIdentity()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+AnimatorScript::AnimatorScript(const std::string &path):
+path(path),
+modified(0)
+{}
+
+time_t AnimatorScript::modificationTime(const std::string &path) {
+    struct stat status;
+    return stat(path.c_str(), &status) == 0 ? status.st_mtime : 0;
+}
+
+bool AnimatorScript::changed() const {
+    return modificationTime(path) != modified;
+}
+
+bool AnimatorScript::load() {
+    // Noted first, so an edit made while reading is picked up next time,
+    // and a broken file is reported once rather than on every check.
+    modified = modificationTime(path);
+    std::ifstream file(path);
+    if (!file) {
+        ofLogError("AnimatorScript") << "couldn't read " << path;
+        return false;
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+    return parse(text.str());
+}
+
+bool AnimatorScript::parse(const std::string &text) {
+    static const char *fieldNames[] = { "aspect", "branchAngle", "terminusAngle", "size", "offset" };
+    std::string name = path.empty() ? "animator script" : path;
+    std::vector<std::array<AnimatorExpression, 5>> parsed;
+    std::istringstream lines(text);
+    std::string line;
+    for (int number = 1; std::getline(lines, line); number++) {
+        line = ofTrim(line.substr(0, line.find('#')));
+        if (line.empty()) {
+            continue;
+        }
+        if (line == "[animator]") {
+            parsed.emplace_back();
+            continue;
+        }
+        size_t equals = line.find('=');
+        std::string field = ofTrim(line.substr(0, min(equals, line.size())));
+        auto found = std::find(std::begin(fieldNames), std::end(fieldNames), field);
+        std::string error;
+        if (equals == std::string::npos || found == std::end(fieldNames)) {
+            error = "expected [animator] or a field = expression line";
+        } else if (parsed.empty()) {
+            error = field + " comes before any [animator]";
+        } else {
+            AnimatorExpression &expression = parsed.back()[found - std::begin(fieldNames)];
+            AnimatorExpression::compile(ofTrim(line.substr(equals + 1)), expression, error);
+        }
+        if (!error.empty()) {
+            ofLogError("AnimatorScript") << name << ":" << number << ": " << error;
+            return false;
+        }
+    }
+    if (parsed.empty()) {
+        ofLogError("AnimatorScript") << name << " defines no animators";
+        return false;
+    }
+    definitions = parsed;
+    return true;
+}
+
+std::vector<NodeAnimator *> AnimatorScript::createAnimators() const {
+    std::vector<NodeAnimator *> animators;
+    for (const std::array<AnimatorExpression, 5> &definition: definitions) {
+        ScriptedNodeAnimator *animator = new ScriptedNodeAnimator();
+        std::copy(definition.begin(), definition.end(), animator->expressions);
+        animators.push_back(animator);
+    }
+    return animators;
+}
+
+bool AnimatorScript::update(const std::vector<NodeAnimator *> &animators) const {
+    if (animators.size() != definitions.size()) {
+        return false;
+    }
+    std::vector<ScriptedNodeAnimator *> scripted;
+    for (NodeAnimator *animator: animators) {
+        scripted.push_back(dynamic_cast<ScriptedNodeAnimator *>(animator));
+        if (scripted.back() == nullptr) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < scripted.size(); i++) {
+        std::copy(definitions[i].begin(), definitions[i].end(), scripted[i]->expressions);
+    }
+    return true;
+}
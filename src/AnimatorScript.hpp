@@ -0,0 +1,180 @@
+//
+//  AnimatorScript.hpp
+//  CircleTree
+//
+
+#ifndef AnimatorScript_hpp
+#define AnimatorScript_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <array>
+#include <string>
+#include <vector>
+#include <time.h>
+#include "Trees.hpp"
+
+// One animated BranchParameters channel written as an expression over the
+// node's current value v and the animation time d, such as
+//
+//     sin(d/2 + v/100) * 90 - 45
+//
+// with + - * /, unary minus, parentheses, numbers, pi and the functions sin,
+// cos, sqrt, abs, floor, min, max and pow. sin and cos are fastSin.
+//
+// Expressions are compiled to a small stack bytecode in two parts. Constant
+// subexpressions are folded while parsing. Subexpressions of d alone are the
+// same for every node, so they make up a uniform program run once per call.
+// The rest is run over blocks of laneCount nodes, every instruction looping
+// over the whole block, so dispatch costs once per instruction per block
+// instead of once per node. Operations with a constant or uniform operand
+// read it from its table rather than from a filled stack slot.
+class AnimatorExpression {
+public:
+    static constexpr int laneCount = 256;
+    static constexpr int maxStackDepth = 16;
+    static constexpr int maxUniforms = 32;
+    
+    // v, which leaves every value alone.
+    AnimatorExpression();
+    
+    // Returns false, with why in error, when source doesn't parse or needs
+    // more than maxStackDepth values at once or maxUniforms subexpressions of
+    // d. expression is left alone then.
+    static bool compile(const std::string &source, AnimatorExpression &expression, std::string &error);
+    
+    const std::string &source() const {
+        return text;
+    }
+    
+    bool isIdentity() const;
+    
+    // Expressions without v give every node the same value, so it can be
+    // evaluated once and broadcast.
+    bool isTimeOnly() const {
+        return !usesValue;
+    }
+    
+    float evaluate(float v, float t) const;
+    // Evaluates in place over count contiguous values.
+    void evaluate(float *values, int count, float t) const;
+    
+private:
+    enum Opcode: uint8_t {
+        Value,
+        Time,
+        // Only in the parse tree; the bytecode has Load.
+        Constant,
+        Load,
+        Store,
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+        // b - a and b / a, for scalars on the left.
+        ReverseSubtract,
+        ReverseDivide,
+        Negate,
+        Sin,
+        Cos,
+        Sqrt,
+        Abs,
+        Floor,
+        Min,
+        Max,
+        Pow
+    };
+    
+    // Where Load and the binary operations find their operand. Binary
+    // operations on the stack take two slots and leave one.
+    enum Source: uint8_t {
+        Stack,
+        Constants,
+        Uniforms
+    };
+    
+    struct Instruction {
+        Opcode opcode;
+        Source source;
+        // Index into constants or uniforms.
+        uint16_t operand;
+    };
+    
+    struct Parser;
+    
+    std::string text;
+    // Fills the uniforms, one Store each.
+    std::vector<Instruction> uniformCode;
+    // Leaves the result on the stack.
+    std::vector<Instruction> code;
+    std::vector<float> constants;
+    int uniformCount;
+    bool usesValue;
+    
+    static void run(const std::vector<Instruction> &code, const float *constants, float *uniforms, const float *values, float t, float *stack, int stride, int count);
+};
+
+// A NodeAnimator whose five channels are AnimatorExpressions. Tree::save
+// doesn't store expressions, so these come back static from a TreeFile.
+class ScriptedNodeAnimator: public NodeAnimator {
+public:
+    // In BranchParameters order.
+    AnimatorExpression expressions[5];
+    
+    ScriptedNodeAnimator();
+    
+    void applyTo(TreeNodes &nodes, int node, float dt) override;
+    void applyTo(TreeNodes &nodes, const int *group, int count, float *scratch, float dt) override;
+    void applyTo(float *const *fields, int count, float dt) override;
+    bool isStatic() const override;
+};
+
+// Animator definitions read from a text file, one section per animator:
+//
+//     # Comments run to the end of the line.
+//     [animator]
+//     terminusAngle = sin(d/2 + v/100) * 90 - 45
+//     size = 0.4 + 0.1 * sin(d)
+//     offset = 0.1 + 0.1 * cos(d/20)
+//
+// Each line names a BranchParameters field; fields a section leaves out keep
+// their values. The file can be edited while the app runs: load() reads it
+// again and update() hands the new definitions to the tree's animators in
+// place, so motion changes without regenerating the tree.
+class AnimatorScript {
+public:
+    std::string path;
+    
+    AnimatorScript(const std::string &path);
+    
+    // Reads and compiles path. Returns false, logging the line of the first
+    // error, when the file is missing or wrong; the previous definitions
+    // are kept then.
+    bool load();
+    // Compiles text as the contents of a file, for definitions that don't
+    // come from one.
+    bool parse(const std::string &text);
+    
+    // Whether path was modified since it was last loaded.
+    bool changed() const;
+    
+    int animatorCount() const {
+        return (int)definitions.size();
+    }
+    
+    // One new animator per section, for TreeAnimatorInstaller.
+    std::vector<NodeAnimator *> createAnimators() const;
+    // Gives animators made by createAnimators the current definitions.
+    // Returns false, changing nothing, when they are a different number or
+    // not all ScriptedNodeAnimators, so they need installing afresh.
+    bool update(const std::vector<NodeAnimator *> &animators) const;
+    
+private:
+    // Five expressions per animator, in BranchParameters order.
+    std::vector<std::array<AnimatorExpression, 5>> definitions;
+    time_t modified;
+    
+    static time_t modificationTime(const std::string &path);
+};
+
+#endif /* AnimatorScript_hpp */
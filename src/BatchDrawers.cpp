@@ -0,0 +1,383 @@
+//
+//  BatchDrawers.cpp
+//  CircleTree
+//
+
+#include "BatchDrawers.hpp"
+#include <vector>
+#include <math.h>
+
+static const std::string circleVertexShader = R"(
+#version 150
+
+uniform mat4 modelViewProjectionMatrix;
+
+in vec4 position;
+in vec3 instance;
+
+void main() {
+    gl_Position = modelViewProjectionMatrix * vec4(instance.xy + position.xy * instance.z, 0.0, 1.0);
+}
+)";
+
+static const std::string circleFragmentShader = R"(
+#version 150
+
+uniform vec4 globalColor;
+
+out vec4 outputColor;
+
+void main() {
+    outputColor = globalColor;
+}
+)";
+
+CircleBatchDrawer::CircleBatchDrawer(Tree *tree, int resolution):
+tree(tree),
+resolution(resolution),
+instanceBufferSize(0),
+glReady(false)
+{
+    for (int segments = 8; segments < resolution; segments *= 2) {
+        bucketSegments.push_back(segments);
+    }
+    bucketSegments.push_back(resolution);
+    bucketStarts.assign(bucketSegments.size() + 1, 0);
+}
+
+void CircleBatchDrawer::setupGL() {
+    circles.resize(bucketSegments.size());
+    for (size_t bucket = 0; bucket < bucketSegments.size(); bucket++) {
+        int segments = bucketSegments[bucket];
+        std::vector<glm::vec3> vertices;
+        vertices.reserve(segments + 2);
+        vertices.push_back(glm::vec3(0, 0, 0));
+        for (int i = 0; i <= segments; i++) {
+            float angle = TWO_PI * i / segments;
+            vertices.push_back(glm::vec3(cosf(angle), sinf(angle), 0));
+        }
+        circles[bucket].setVertexData(vertices.data(), segments + 2, GL_STATIC_DRAW);
+    }
+    
+    shader.setupShaderFromSource(GL_VERTEX_SHADER, circleVertexShader);
+    shader.setupShaderFromSource(GL_FRAGMENT_SHADER, circleFragmentShader);
+    shader.bindDefaults();
+    shader.linkProgram();
+    instanceLocation = shader.getAttributeLocation("instance");
+    glReady = true;
+}
+
+int CircleBatchDrawer::bucketFor(float radius) const {
+    int segments = lod.segments(radius, resolution);
+    int bucket = 0;
+    while (bucketSegments[bucket] < segments) {
+        bucket++;
+    }
+    return bucket;
+}
+
+int CircleBatchDrawer::vertexCount() const {
+    int count = 0;
+    for (size_t bucket = 0; bucket < bucketSegments.size(); bucket++) {
+        count += (bucketStarts[bucket + 1] - bucketStarts[bucket]) * (bucketSegments[bucket] + 2);
+    }
+    return count;
+}
+
+int CircleBatchDrawer::drawCount() const {
+    int count = 0;
+    for (size_t bucket = 0; bucket < bucketSegments.size(); bucket++) {
+        count += bucketStarts[bucket + 1] > bucketStarts[bucket] ? 1 : 0;
+    }
+    return count;
+}
+
+void CircleBatchDrawer::update(const RenderedTree &renderedTree) {
+    int bucketCount = (int)bucketSegments.size();
+    float radius = renderedTree.size / 2;
+    
+    if (!lod.enabled && !culling.enabled) {
+        int count = renderedTree.count();
+        instances.resize(count);
+        for (int node = 0; node < count; node++) {
+            const RenderedTreeNode &rendered = renderedTree.nodes[node];
+            instances[node] = { rendered.position.x, rendered.position.y, radius * rendered.scale };
+        }
+        bucketStarts.assign(bucketCount + 1, count);
+        bucketStarts[0] = 0;
+        return;
+    }
+    
+    collectVisibleNodes(tree, renderedTree, lod, culling, visible, frontier, nextFrontier);
+    int count = (int)visible.size();
+    unsorted.resize(count);
+    bucketIndices.resize(count);
+    for (int i = 0; i < count; i++) {
+        const RenderedTreeNode &rendered = renderedTree.nodes[visible[i]];
+        unsorted[i] = { rendered.position.x, rendered.position.y, radius * rendered.scale };
+        bucketIndices[i] = bucketFor(unsorted[i].radius);
+    }
+    sortIntoBuckets();
+}
+
+// A node is never bigger than its parent, so testing every circle drops
+// the same circles for LOD as pruning subtrees does.
+void CircleBatchDrawer::update(const Forest &forest) {
+    int bucketCount = (int)bucketSegments.size();
+    float radius = forest.tree->size / 2;
+    const std::vector<ForestNode> &nodes = forest.nodes();
+    int count = (int)nodes.size();
+    
+    if (!lod.enabled && !culling.enabled) {
+        instances.resize(count);
+        for (int i = 0; i < count; i++) {
+            instances[i] = { nodes[i].x, nodes[i].y, radius * nodes[i].scale };
+        }
+        bucketStarts.assign(bucketCount + 1, count);
+        bucketStarts[0] = 0;
+        return;
+    }
+    
+    unsorted.clear();
+    bucketIndices.clear();
+    for (int i = 0; i < count; i++) {
+        Instance instance = { nodes[i].x, nodes[i].y, radius * nodes[i].scale };
+        if (!lod.isVisible(instance.radius) ||
+            (culling.enabled && !BoundingCircle(instance.x, instance.y, instance.radius).intersects(culling.viewport))) {
+            continue;
+        }
+        unsorted.push_back(instance);
+        bucketIndices.push_back(bucketFor(instance.radius));
+    }
+    sortIntoBuckets();
+}
+
+void CircleBatchDrawer::sortIntoBuckets() {
+    int bucketCount = (int)bucketSegments.size();
+    int count = (int)unsorted.size();
+    bucketStarts.assign(bucketCount + 1, 0);
+    for (int i = 0; i < count; i++) {
+        bucketStarts[bucketIndices[i] + 1]++;
+    }
+    for (int bucket = 0; bucket < bucketCount; bucket++) {
+        bucketStarts[bucket + 1] += bucketStarts[bucket];
+    }
+    
+    instances.resize(count);
+    bucketCursors.assign(bucketStarts.begin(), bucketStarts.end() - 1);
+    for (int i = 0; i < count; i++) {
+        instances[bucketCursors[bucketIndices[i]]++] = unsorted[i];
+    }
+}
+
+void CircleBatchDrawer::draw() {
+    int count = instanceCount();
+    if (count == 0) {
+        return;
+    }
+    if (!glReady) {
+        setupGL();
+    }
+    
+    size_t size = count * sizeof(Instance);
+    if (size > instanceBufferSize) {
+        instanceBuffer.allocate(size, GL_STREAM_DRAW);
+        instanceBufferSize = size;
+    }
+    instanceBuffer.updateData(0, size, instances.data());
+    
+    shader.begin();
+    for (size_t bucket = 0; bucket < bucketSegments.size(); bucket++) {
+        int first = bucketStarts[bucket];
+        int bucketCount = bucketStarts[bucket + 1] - first;
+        if (bucketCount == 0) {
+            continue;
+        }
+        ofVbo &circle = circles[bucket];
+        circle.setAttributeBuffer(instanceLocation, instanceBuffer, 3, sizeof(Instance), first * sizeof(Instance));
+        circle.setAttributeDivisor(instanceLocation, 1);
+        circle.drawInstanced(GL_TRIANGLE_FAN, 0, bucketSegments[bucket] + 2, bucketCount);
+    }
+    shader.end();
+}
+
+void CircleBatchDrawer::draw(SoftwareCanvas &canvas) {
+    canvas.fillCircles(instances.data(), instanceCount());
+}
+
+LeafBatchDrawer::LeafBatchDrawer(Tree *tree):
+tree(tree),
+complete(false)
+{
+    mesh.setMode(OF_PRIMITIVE_LINES);
+    mesh.setUsage(GL_STREAM_DRAW);
+}
+
+void LeafBatchDrawer::rebuildColors(const RenderedTree &renderedTree) {
+    int count = renderedTree.count();
+    std::vector<ofFloatColor> &colors = mesh.getColors();
+    colors.resize(max(count - 1, 0) * 2);
+    for (int node = Tree::root + 1; node < count; node++) {
+        ofFloatColor color = renderedTree.nodes[node].color;
+        colors[(node - 1) * 2] = color;
+        colors[(node - 1) * 2 + 1] = color;
+    }
+}
+
+// LeafTreeDrawer draws (0, 0)-(1, 1) in the node's frame after undoing the
+// scale accumulated down to its parent, which includes the root's size
+// parameter even though no transform applies it.
+static void writeLineAt(float x, float y, float angle, float length, glm::vec3 *vertices) {
+    float radians = ofDegToRad(angle);
+    float c = cosf(radians) * length;
+    float s = sinf(radians) * length;
+    
+    vertices[0] = glm::vec3(x, y, 0);
+    vertices[1] = glm::vec3(x + c - s, y + s + c, 0);
+}
+
+void LeafBatchDrawer::writeLine(const RenderedTree &renderedTree, int node, glm::vec3 *vertices) {
+    const RenderedTreeNode &renderedNode = renderedTree.nodes[node];
+    float length = renderedNode.scale / (renderedTree.nodes[renderedNode.parent].scale * renderedTree.rootScale);
+    writeLineAt(renderedNode.position.x, renderedNode.position.y, renderedNode.angle, length, vertices);
+}
+
+// An instance's scale multiplies everything LeafTreeDrawer would draw, the
+// unit line included.
+void LeafBatchDrawer::writeLine(const Forest &forest, int instance, int node, glm::vec3 *vertices) {
+    const ForestNode *rendered = forest.nodes().data() + (size_t)instance * forest.nodeCount();
+    const ForestNode &renderedNode = rendered[node];
+    float instanceScale = forest.instance(instance).scale;
+    float length = renderedNode.scale * instanceScale / (rendered[forest.tree->nodes.parent[node]].scale * forest.rootScale(instance));
+    writeLineAt(renderedNode.x, renderedNode.y, renderedNode.angle, length, vertices);
+}
+
+void LeafBatchDrawer::update(const RenderedTree &renderedTree) {
+    int count = renderedTree.count();
+    
+    // LeafTreeDrawer's last line is the root's last child, drawn after the
+    // rest of the tree has unwound. It sets the color even when culled.
+    if (count > 1) {
+        const TreeNodes &nodes = tree->nodes;
+        int lastChild = nodes.firstChild[Tree::root] + nodes.childCount[Tree::root] - 1;
+        finalColor = renderedTree.nodes[lastChild].color;
+    }
+    
+    if (culling.enabled) {
+        updateVisible(renderedTree);
+        return;
+    }
+    
+    int vertexCount = max(count - 1, 0) * 2;
+    if (!complete || (int)mesh.getNumVertices() != vertexCount) {
+        mesh.getVertices().resize(vertexCount);
+        rebuildColors(renderedTree);
+        complete = true;
+    }
+    
+    glm::vec3 *vertices = mesh.getVertices().data();
+    for (int node = Tree::root + 1; node < count; node++) {
+        writeLine(renderedTree, node, vertices + (node - 1) * 2);
+    }
+}
+
+void LeafBatchDrawer::updateVisible(const RenderedTree &renderedTree) {
+    collectVisibleNodes(tree, renderedTree, LevelOfDetail(), culling, visible, frontier, nextFrontier);
+    // The root has no line.
+    int lines = (int)visible.size() - (visible.empty() ? 0 : 1);
+    std::vector<glm::vec3> &vertices = mesh.getVertices();
+    std::vector<ofFloatColor> &colors = mesh.getColors();
+    vertices.resize(lines * 2);
+    colors.resize(lines * 2);
+    complete = false;
+    
+    for (int i = 0; i < lines; i++) {
+        int node = visible[i + 1];
+        writeLine(renderedTree, node, vertices.data() + i * 2);
+        ofFloatColor color = renderedTree.nodes[node].color;
+        colors[i * 2] = color;
+        colors[i * 2 + 1] = color;
+    }
+}
+
+void LeafBatchDrawer::rebuildColors(const Forest &forest) {
+    int count = forest.nodeCount();
+    int lines = max(count - 1, 0);
+    std::vector<ofFloatColor> &colors = mesh.getColors();
+    colors.resize((size_t)forest.instanceCount() * lines * 2);
+    for (int node = Tree::root + 1; node < count; node++) {
+        ofFloatColor color = forest.color(node);
+        for (int instance = 0; instance < forest.instanceCount(); instance++) {
+            size_t line = (size_t)instance * lines + node - 1;
+            colors[line * 2] = color;
+            colors[line * 2 + 1] = color;
+        }
+    }
+}
+
+void LeafBatchDrawer::update(const Forest &forest) {
+    int count = forest.nodeCount();
+    if (count > 1) {
+        const TreeNodes &nodes = forest.tree->nodes;
+        finalColor = forest.color(nodes.firstChild[Tree::root] + nodes.childCount[Tree::root] - 1);
+    }
+    
+    if (culling.enabled) {
+        updateVisible(forest);
+        return;
+    }
+    
+    int lines = max(count - 1, 0);
+    int vertexCount = forest.instanceCount() * lines * 2;
+    if (!complete || (int)mesh.getNumVertices() != vertexCount) {
+        mesh.getVertices().resize(vertexCount);
+        rebuildColors(forest);
+        complete = true;
+    }
+    
+    glm::vec3 *vertices = mesh.getVertices().data();
+    for (int instance = 0; instance < forest.instanceCount(); instance++) {
+        for (int node = Tree::root + 1; node < count; node++) {
+            writeLine(forest, instance, node, vertices + ((size_t)instance * lines + node - 1) * 2);
+        }
+    }
+}
+
+// Line by line, against the circle through both ends.
+void LeafBatchDrawer::updateVisible(const Forest &forest) {
+    int count = forest.nodeCount();
+    std::vector<glm::vec3> &vertices = mesh.getVertices();
+    std::vector<ofFloatColor> &colors = mesh.getColors();
+    vertices.clear();
+    colors.clear();
+    complete = false;
+    
+    glm::vec3 line[2];
+    for (int instance = 0; instance < forest.instanceCount(); instance++) {
+        for (int node = Tree::root + 1; node < count; node++) {
+            writeLine(forest, instance, node, line);
+            float dx = line[1].x - line[0].x;
+            float dy = line[1].y - line[0].y;
+            BoundingCircle bounds(line[0].x + dx / 2, line[0].y + dy / 2, sqrtf(dx * dx + dy * dy) / 2);
+            if (!bounds.intersects(culling.viewport)) {
+                continue;
+            }
+            ofFloatColor color = forest.color(node);
+            vertices.push_back(line[0]);
+            vertices.push_back(line[1]);
+            colors.push_back(color);
+            colors.push_back(color);
+        }
+    }
+}
+
+void LeafBatchDrawer::draw() {
+    mesh.draw();
+    // The drawBuffer blit in ofApp::draw is tinted by whatever color the leaf
+    // pass leaves current, so end on the same color LeafTreeDrawer does.
+    ofSetColor(finalColor);
+}
+
+void LeafBatchDrawer::draw(SoftwareCanvas &canvas) {
+    canvas.drawLines(mesh.getVertices().data(), mesh.getColors().data(), lineCount());
+}
@@ -0,0 +1,131 @@
+//
+//  BatchDrawers.hpp
+//  CircleTree
+//
+
+#ifndef BatchDrawers_hpp
+#define BatchDrawers_hpp
+
+#include <stdio.h>
+#include <vector>
+#include "Trees.hpp"
+#include "Forest.hpp"
+#include "SoftwareCanvas.hpp"
+
+// Draws every node's circle with one instanced call against a shared unit
+// circle, with (x, y, radius) uploaded once per frame as instance data.
+// With lod enabled, sub-pixel subtrees are dropped and instances are sorted
+// into buckets of unit circles with fewer segments, one draw per bucket.
+// With culling enabled, subtrees outside the viewport are dropped too.
+//
+// A whole Forest can be drawn the same way, every instance's circles in the
+// same few draws, with LOD and culling tested circle by circle.
+class CircleBatchDrawer {
+public:
+    Tree *tree;
+    LevelOfDetail lod;
+    ViewportCulling culling;
+    
+    // GL objects are created on the first draw(), so update() also works
+    // without a context.
+    CircleBatchDrawer(Tree *tree, int resolution = 200);
+    
+    // CPU side: rebuild instance attributes from this frame's snapshot.
+    void update(const RenderedTree &renderedTree);
+    // The same from a rendered forest, in forest coordinates.
+    void update(const Forest &forest);
+    // GL side: upload instance attributes and issue the instanced draws.
+    void draw();
+    // Without GL: fill the same circles on the canvas in its current color.
+    void draw(SoftwareCanvas &canvas);
+    
+    int instanceCount() const {
+        return (int)instances.size();
+    }
+    
+    int vertexCount() const;
+    int drawCount() const;
+    
+private:
+    // (x, y, radius), laid out as the canvas takes them.
+    typedef SoftwareCanvas::Circle Instance;
+    
+    std::vector<Instance> instances;
+    std::vector<int> visible;
+    // collectVisibleNodes' scratch.
+    NodeRanges frontier;
+    NodeRanges nextFrontier;
+    // Visible instances before sorting; bucketIndices holds their buckets.
+    std::vector<Instance> unsorted;
+    
+    int resolution;
+    // Segment counts per bucket, ascending; the last is resolution.
+    std::vector<int> bucketSegments;
+    // Instances are stored bucket by bucket.
+    std::vector<int> bucketStarts;
+    std::vector<int> bucketIndices;
+    std::vector<int> bucketCursors;
+    
+    std::vector<ofVbo> circles;
+    ofShader shader;
+    int instanceLocation;
+    ofBufferObject instanceBuffer;
+    size_t instanceBufferSize;
+    bool glReady;
+    
+    void setupGL();
+    int bucketFor(float radius) const;
+    // Counting sort of unsorted into instances by bucket.
+    void sortIntoBuckets();
+};
+
+// Draws one colored line per non-root node into a persistent line mesh, the
+// batched equivalent of LeafTreeDrawer. Colors come from the snapshot's
+// per-node colors and are only re-uploaded when the topology changes, unless
+// culling is enabled, in which case only visible lines are written, colors
+// included. A Forest's lines all go into the same mesh, instance by
+// instance.
+class LeafBatchDrawer {
+public:
+    Tree *tree;
+    ViewportCulling culling;
+    
+    LeafBatchDrawer(Tree *tree);
+    
+    // CPU side: rewrite line endpoints from this frame's snapshot.
+    void update(const RenderedTree &renderedTree);
+    // The same from a rendered forest, in forest coordinates.
+    void update(const Forest &forest);
+    // GL side: one vertex buffer update and one draw.
+    void draw();
+    // Without GL: the same lines on the canvas.
+    void draw(SoftwareCanvas &canvas);
+    
+    // The color draw() leaves current, which tints ofApp's drawBuffer blit.
+    const ofFloatColor &tint() const {
+        return finalColor;
+    }
+    
+    int lineCount() const {
+        return (int)mesh.getNumVertices() / 2;
+    }
+    
+private:
+    ofVboMesh mesh;
+    ofFloatColor finalColor;
+    std::vector<int> visible;
+    // collectVisibleNodes' scratch.
+    NodeRanges frontier;
+    NodeRanges nextFrontier;
+    // Whether the mesh holds every line at its node's slot, with colors.
+    bool complete;
+    
+    void rebuildColors(const RenderedTree &renderedTree);
+    void rebuildColors(const Forest &forest);
+    void updateVisible(const RenderedTree &renderedTree);
+    void updateVisible(const Forest &forest);
+    void writeLine(const RenderedTree &renderedTree, int node, glm::vec3 *vertices);
+    void writeLine(const Forest &forest, int instance, int node, glm::vec3 *vertices);
+};
+
+#endif /* BatchDrawers_hpp */
@@ -0,0 +1,220 @@
+//
+//  Forest.cpp
+//  CircleTree
+//
+
+#include "Forest.hpp"
+#include <math.h>
+
+// Where in [0, 1) a seed puts an animator, from a murmur3 finalizer over
+// both.
+static float seedFraction(uint32_t seed, int animator) {
+    uint32_t hash = seed * 0x9e3779b9u + (uint32_t)animator * 0x85ebca6bu;
+    hash ^= hash >> 16;
+    hash *= 0x7feb352du;
+    hash ^= hash >> 15;
+    hash *= 0x846ca68bu;
+    hash ^= hash >> 16;
+    return (hash >> 8) * (1.0f / 16777216);
+}
+
+Forest::Forest(Tree *tree):
+tree(tree),
+palette(defaultTreePalette()),
+pool(nullptr),
+grainSize(8192),
+seedSpread(60),
+count(-1),
+stride(0),
+generation(-1),
+blended(false)
+{}
+
+int Forest::add(const ForestInstance &instance) {
+    instances.push_back(instance);
+    int index = (int)instances.size() - 1;
+    // Otherwise the next animate() lays out every instance anyway.
+    if (isCurrent()) {
+        parameters.resize((size_t)instances.size() * parameterCount * stride, 0);
+        renderedNodes.resize((size_t)instances.size() * count);
+        resetInstance(index);
+    }
+    return index;
+}
+
+void Forest::clear() {
+    instances.clear();
+    parameters.clear();
+    renderedNodes.clear();
+    previousNodes.clear();
+    blended = false;
+}
+
+ofColor Forest::color(int node) const {
+    return treePaletteColor(palette, tree->nodes.height[node]);
+}
+
+bool Forest::isCurrent() const {
+    return count == tree->nodes.count() && generation == tree->animatorGeneration;
+}
+
+void Forest::layout() {
+    const TreeNodes &nodes = tree->nodes;
+    count = nodes.count();
+    stride = (count + 15) / 16 * 16;
+    generation = tree->animatorGeneration;
+    
+    // Counting sort of the nodes by animator, keeping index order within
+    // each group.
+    int animatorCount = (int)tree->animators.size();
+    groupStarts.assign(animatorCount + 2, 0);
+    std::vector<int> groups(count);
+    for (int node = 0; node < count; node++) {
+        int animator = nodes.animator[node];
+        groups[node] = animator >= 0 && animator < animatorCount ? animator : animatorCount;
+        groupStarts[groups[node] + 1]++;
+    }
+    for (int group = 0; group <= animatorCount; group++) {
+        groupStarts[group + 1] += groupStarts[group];
+    }
+    std::vector<int> cursors(groupStarts.begin(), groupStarts.end() - 1);
+    nodeSlots.resize(count);
+    for (int node = 0; node < count; node++) {
+        nodeSlots[node] = cursors[groups[node]]++;
+    }
+    
+    parameters.assign((size_t)instances.size() * parameterCount * stride, 0);
+    renderedNodes.resize((size_t)instances.size() * count);
+    for (int instance = 0; instance < instanceCount(); instance++) {
+        resetInstance(instance);
+    }
+}
+
+void Forest::reset() {
+    if (!isCurrent()) {
+        layout();
+        return;
+    }
+    for (int instance = 0; instance < instanceCount(); instance++) {
+        resetInstance(instance);
+    }
+}
+
+void Forest::resetInstance(int instance) {
+    const TreeNodes &nodes = tree->nodes;
+    const float *fields[] = { nodes.aspect, nodes.branchAngle, nodes.terminusAngle, nodes.size, nodes.offset };
+    float *block = parameterBlock(instance);
+    for (int field = 0; field < parameterCount; field++) {
+        float *row = block + (size_t)field * stride;
+        for (int node = 0; node < count; node++) {
+            row[nodeSlots[node]] = fields[field][node];
+        }
+    }
+}
+
+void Forest::forEachChunk(const std::function<void(int, int)> &body) {
+    if (pool == nullptr) {
+        body(0, instanceCount());
+        return;
+    }
+    pool->parallelFor(0, instanceCount(), max(1, grainSize / max(count, 1)), body);
+}
+
+void Forest::animate(float time) {
+    if (!isCurrent()) {
+        layout();
+    }
+    forEachChunk([&](int begin, int end) {
+        animateRange(time, begin, end);
+    });
+}
+
+void Forest::animateRange(float time, int begin, int end) {
+    int animatorCount = (int)tree->animators.size();
+    for (int instance = begin; instance < end; instance++) {
+        const ForestInstance &forestInstance = instances[instance];
+        float *block = parameterBlock(instance);
+        for (int animator = 0; animator < animatorCount; animator++) {
+            int first = groupStarts[animator];
+            int size = groupStarts[animator + 1] - first;
+            NodeAnimator *nodeAnimator = tree->animators[animator];
+            if (size == 0 || nodeAnimator->isStatic()) {
+                continue;
+            }
+            float *fields[parameterCount];
+            for (int field = 0; field < parameterCount; field++) {
+                fields[field] = block + (size_t)field * stride + first;
+            }
+            float offset = forestInstance.seed == 0 ? 0 : seedFraction(forestInstance.seed, animator) * seedSpread;
+            nodeAnimator->applyTo(fields, size, time + forestInstance.phase + offset);
+        }
+    }
+}
+
+void Forest::render() {
+    if (!isCurrent()) {
+        layout();
+    }
+    blended = false;
+    if (count == 0) {
+        return;
+    }
+    previousNodes.swap(renderedNodes);
+    renderedNodes.resize((size_t)instances.size() * count);
+    forEachChunk([&](int begin, int end) {
+        renderRange(begin, end);
+    });
+}
+
+void Forest::interpolate(float alpha) {
+    blended = previousNodes.size() == renderedNodes.size() && count > 0;
+    if (!blended) {
+        return;
+    }
+    blendedNodes.resize(renderedNodes.size());
+    forEachChunk([&](int begin, int end) {
+        size_t first = (size_t)begin * count;
+        size_t last = (size_t)end * count;
+        for (size_t i = first; i < last; i++) {
+            const ForestNode &a = previousNodes[i];
+            const ForestNode &b = renderedNodes[i];
+            blendedNodes[i] = { a.x + (b.x - a.x) * alpha,
+                                a.y + (b.y - a.y) * alpha,
+                                a.scale + (b.scale - a.scale) * alpha,
+                                a.angle + (b.angle - a.angle) * alpha };
+        }
+    });
+}
+
+// TreeRenderer::renderRange's transform, from the instance's root frame
+// instead of the identity.
+void Forest::renderRange(int begin, int end) {
+    const TreeNodes &nodes = tree->nodes;
+    float radius = tree->size / 2;
+    const int *slots = nodeSlots.data();
+    
+    for (int instance = begin; instance < end; instance++) {
+        const ForestInstance &forestInstance = instances[instance];
+        const float *block = parameterBlock(instance);
+        const float *branchAngle = block + stride;
+        const float *terminusAngle = block + (size_t)2 * stride;
+        const float *size = block + (size_t)3 * stride;
+        const float *offset = block + (size_t)4 * stride;
+        ForestNode *rendered = renderedNodes.data() + (size_t)instance * count;
+        
+        rendered[Tree::root] = { forestInstance.x, forestInstance.y, forestInstance.scale, forestInstance.rotation };
+        for (int node = Tree::root + 1; node < count; node++) {
+            int slot = slots[node];
+            const ForestNode &parent = rendered[nodes.parent[node]];
+            float terminus = parent.angle + terminusAngle[slot];
+            float distance = parent.scale * (-radius - offset[slot] * radius);
+            float radians = ofDegToRad(terminus);
+            
+            ForestNode &renderedNode = rendered[node];
+            renderedNode.x = parent.x - sinf(radians) * distance;
+            renderedNode.y = parent.y + cosf(radians) * distance;
+            renderedNode.scale = parent.scale * size[slot];
+            renderedNode.angle = terminus + branchAngle[slot];
+        }
+    }
+}
@@ -0,0 +1,152 @@
+//
+//  Forest.hpp
+//  CircleTree
+//
+
+#ifndef Forest_hpp
+#define Forest_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <functional>
+#include "Trees.hpp"
+#include "ThreadPool.hpp"
+
+// One tree of a Forest, placed in forest coordinates.
+struct ForestInstance {
+public:
+    float x;
+    float y;
+    // Multiplies the tree's size.
+    float scale;
+    // Degrees.
+    float rotation;
+    // Seconds added to the animation time.
+    float phase;
+    // Offsets each animator's time by its own amount, so instances with the
+    // same phase still move differently. 0 leaves the times alone.
+    uint32_t seed;
+    
+    ForestInstance(): x(0), y(0), scale(1), rotation(0), phase(0), seed(0) {}
+    ForestInstance(float x, float y, float scale, float rotation, float phase, uint32_t seed):
+    x(x), y(y), scale(scale), rotation(rotation), phase(phase), seed(seed) {}
+};
+
+// A node of a rendered instance, in forest coordinates. scale includes the
+// instance's.
+struct ForestNode {
+public:
+    float x;
+    float y;
+    float scale;
+    // Degrees, as in RenderedTreeNode.
+    float angle;
+};
+
+// Many instances of one tree. The instances share the tree's topology,
+// animator assignments and colors; each keeps only its own copy of the
+// BranchParameters, starting from the tree's, and its rendered nodes.
+//
+// Parameters are stored instance by instance with the nodes reordered so
+// each animator's nodes are contiguous, so animation is one straight run per
+// animator and field with no gather. Animation and rendering are split
+// across the pool by instance.
+class Forest {
+public:
+    // Not owned. Its topology and animators are shared by every instance;
+    // its parameters are only where each instance starts.
+    Tree *tree;
+    // As TreeRenderer's, and starts from the same defaultTreePalette().
+    std::vector<ofColor> palette;
+    ThreadPool *pool;
+    // Nodes per chunk, counting every node of every instance in it.
+    int grainSize;
+    // The longest time offset a seed gives an animator, in seconds.
+    float seedSpread;
+    
+    Forest(Tree *tree);
+    
+    // Returns the new instance's index.
+    int add(const ForestInstance &instance);
+    void clear();
+    
+    int instanceCount() const {
+        return (int)instances.size();
+    }
+    
+    const ForestInstance &instance(int index) const {
+        return instances[index];
+    }
+    
+    // Nodes per instance.
+    int nodeCount() const {
+        return count;
+    }
+    
+    // Puts every instance's parameters back to the tree's. Done by animate()
+    // whenever the tree's nodes or animator assignments change.
+    void reset();
+    // Animates every instance to time plus its phase.
+    void animate(float time);
+    // Computes every instance's world transforms. The previous render is
+    // kept for interpolate().
+    void render();
+    // Blends the last two renders, alpha of the way from the older to the
+    // newer, into nodes() until the next render. Does nothing until there
+    // have been two renders of the same instances.
+    void interpolate(float alpha);
+    
+    // After render(), instance i's node n is nodes()[i * nodeCount() + n].
+    const std::vector<ForestNode> &nodes() const {
+        return blended ? blendedNodes : renderedNodes;
+    }
+    
+    // An instance's root size parameter, which LeafTreeDrawer's line length
+    // includes (see RenderedTree::rootScale).
+    float rootScale(int instance) const {
+        return parameterBlock(instance)[sizeField * stride + nodeSlots[Tree::root]];
+    }
+    
+    // The palette entry for a node's height, as TreeRenderer colors it.
+    ofColor color(int node) const;
+    
+private:
+    static const int parameterCount = 5;
+    static const int sizeField = 3;
+    
+    std::vector<ForestInstance> instances;
+    int count;
+    // count rounded up to 16.
+    int stride;
+    int generation;
+    // nodeSlots[node] is where a node's parameters sit in each row; the
+    // nodes of animator a fill [groupStarts[a], groupStarts[a + 1]), and
+    // nodes without an animator come last.
+    std::vector<int> nodeSlots;
+    std::vector<int> groupStarts;
+    // parameterCount rows of stride floats per instance.
+    std::vector<float> parameters;
+    std::vector<ForestNode> renderedNodes;
+    std::vector<ForestNode> previousNodes;
+    std::vector<ForestNode> blendedNodes;
+    // Whether nodes() is blendedNodes.
+    bool blended;
+    
+    float *parameterBlock(int instance) {
+        return parameters.data() + (size_t)instance * parameterCount * stride;
+    }
+    
+    const float *parameterBlock(int instance) const {
+        return parameters.data() + (size_t)instance * parameterCount * stride;
+    }
+    
+    bool isCurrent() const;
+    void layout();
+    void resetInstance(int instance);
+    void animateRange(float time, int begin, int end);
+    void renderRange(int begin, int end);
+    void forEachChunk(const std::function<void(int, int)> &body);
+};
+
+#endif /* Forest_hpp */
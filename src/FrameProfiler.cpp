@@ -0,0 +1,357 @@
+//
+//  FrameProfiler.cpp
+//  CircleTree
+//
+
+#include "FrameProfiler.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+static std::atomic<int> nextThread(0);
+static thread_local int profilerThread = -1;
+
+static int currentThread() {
+    if (profilerThread < 0) {
+        profilerThread = nextThread++;
+    }
+    return profilerThread;
+}
+
+FrameProfiler::Scope::Scope(FrameProfiler *profiler, int phase, bool gpu):
+profiler(profiler),
+phase(phase),
+gpu(false),
+begin(0)
+{
+    if (profiler == nullptr) {
+        return;
+    }
+    this->gpu = gpu && profiler->beginGpu(phase);
+    begin = profiler->now();
+}
+
+FrameProfiler::Scope::~Scope() {
+    if (profiler == nullptr) {
+        return;
+    }
+    profiler->record(phase, begin, profiler->now());
+    if (gpu) {
+        profiler->endGpu();
+    }
+}
+
+FrameProfiler::FrameProfiler(int capacity):
+overlayVisible(false),
+frames(max(capacity, 2)),
+frameCount(0),
+gpuActive(false)
+{
+    epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    for (Frame &frame: frames) {
+        frame.index = UINT64_MAX;
+    }
+    for (QuerySlot &slot: querySlots) {
+        slot.frame = 0;
+    }
+}
+
+FrameProfiler::~FrameProfiler() {
+#ifndef TARGET_OPENGLES
+    for (QuerySlot &slot: querySlots) {
+        if (!slot.queries.empty()) {
+            glDeleteQueries((int)slot.queries.size(), slot.queries.data());
+        }
+    }
+#endif
+}
+
+int FrameProfiler::addPhase(const std::string &name) {
+    // Re-registering a name (e.g. after the scene is rebuilt) reuses its id.
+    auto existing = std::find(phaseNames.begin(), phaseNames.end(), name);
+    if (existing != phaseNames.end()) {
+        return (int)(existing - phaseNames.begin());
+    }
+    phaseNames.push_back(name);
+    return (int)phaseNames.size() - 1;
+}
+
+int FrameProfiler::addCounter(const std::string &name) {
+    auto existing = std::find(counterNames.begin(), counterNames.end(), name);
+    if (existing != counterNames.end()) {
+        return (int)(existing - counterNames.begin());
+    }
+    counterNames.push_back(name);
+    return (int)counterNames.size() - 1;
+}
+
+int64_t FrameProfiler::now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() - epoch;
+}
+
+FrameProfiler::Frame &FrameProfiler::current() {
+    return frames[(frameCount - 1) % frames.size()];
+}
+
+FrameProfiler::Frame *FrameProfiler::finishedFrame(uint64_t index) {
+    Frame &frame = frames[index % frames.size()];
+    if (frame.index != index || frame.end < 0) {
+        return nullptr;
+    }
+    return &frame;
+}
+
+void FrameProfiler::beginFrame() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (frameCount > 0 && current().end < 0) {
+        current().end = now();
+    }
+    Frame &frame = frames[frameCount % frames.size()];
+    frame.index = frameCount;
+    frame.begin = now();
+    frame.end = -1;
+    frame.events.clear();
+    frame.cpu.assign(phaseNames.size(), 0);
+    frame.gpu.assign(phaseNames.size(), -1);
+    frame.counters.assign(counterNames.size(), 0);
+    
+    QuerySlot &slot = querySlots[frameCount % querySlotCount];
+    collectQueries(slot);
+    slot.frame = frameCount;
+    frameCount++;
+}
+
+void FrameProfiler::endFrame() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (frameCount > 0) {
+        current().end = now();
+    }
+}
+
+void FrameProfiler::count(int counter, int64_t value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (frameCount > 0) {
+        current().counters[counter] += value;
+    }
+}
+
+// Work that runs between endFrame and the next beginFrame, e.g. on the
+// pipeline worker, is charged to the frame that just ended.
+void FrameProfiler::record(int phase, int64_t begin, int64_t end) {
+    int thread = currentThread();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (frameCount == 0) {
+        return;
+    }
+    Frame &frame = current();
+    frame.events.push_back({ phase, thread, begin, end });
+    frame.cpu[phase] += end - begin;
+}
+
+bool FrameProfiler::beginGpu(int phase) {
+#ifndef TARGET_OPENGLES
+    // Timer queries don't nest; an inner GPU scope only times the CPU.
+    if (gpuActive || frameCount == 0) {
+        return false;
+    }
+    QuerySlot &slot = querySlots[(frameCount - 1) % querySlotCount];
+    if (slot.phases.size() == slot.queries.size()) {
+        GLuint query;
+        glGenQueries(1, &query);
+        slot.queries.push_back(query);
+    }
+    glBeginQuery(GL_TIME_ELAPSED, slot.queries[slot.phases.size()]);
+    slot.phases.push_back(phase);
+    gpuActive = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void FrameProfiler::endGpu() {
+#ifndef TARGET_OPENGLES
+    glEndQuery(GL_TIME_ELAPSED);
+    gpuActive = false;
+#endif
+}
+
+// Reading a result that isn't available yet would wait for the GPU, so a
+// frame whose queries haven't all come back keeps its GPU columns at -1 and
+// its query objects are abandoned for fresh ones.
+void FrameProfiler::collectQueries(QuerySlot &slot) {
+#ifndef TARGET_OPENGLES
+    bool available = true;
+    for (size_t i = 0; i < slot.phases.size() && available; i++) {
+        GLint ready = 0;
+        glGetQueryObjectiv(slot.queries[i], GL_QUERY_RESULT_AVAILABLE, &ready);
+        available = ready != 0;
+    }
+    if (!available) {
+        glDeleteQueries((int)slot.queries.size(), slot.queries.data());
+        slot.queries.clear();
+        slot.phases.clear();
+        return;
+    }
+    Frame *frame = slot.phases.empty() ? nullptr : finishedFrame(slot.frame);
+    for (size_t i = 0; i < slot.phases.size(); i++) {
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(slot.queries[i], GL_QUERY_RESULT, &elapsed);
+        if (frame != nullptr) {
+            int64_t &gpu = frame->gpu[slot.phases[i]];
+            gpu = max(gpu, (int64_t)0) + (int64_t)elapsed;
+        }
+    }
+#endif
+    slot.phases.clear();
+}
+
+// The last `count` finished frames still in the ring start at first. Every
+// frame but the newest is finished, since beginFrame closes the previous one.
+int FrameProfiler::lastFinished(int count, uint64_t &first) {
+    uint64_t end = frameCount;
+    if (end > 0 && finishedFrame(end - 1) == nullptr) {
+        end--;
+    }
+    uint64_t n = min<uint64_t>(min<uint64_t>(end, frames.size() - 1), count);
+    first = end - n;
+    return (int)n;
+}
+
+void FrameProfiler::drawOverlay(float x, float y, int count) {
+    std::ostringstream text;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t first;
+        int n = lastFinished(count, first);
+        if (n == 0) {
+            return;
+        }
+        
+        std::vector<double> cpu(phaseNames.size(), 0);
+        std::vector<double> gpu(phaseNames.size(), 0);
+        std::vector<int> gpuFrames(phaseNames.size(), 0);
+        double frameTime = 0;
+        for (uint64_t index = first; index < first + n; index++) {
+            const Frame &frame = *finishedFrame(index);
+            frameTime += frame.end - frame.begin;
+            for (size_t phase = 0; phase < phaseNames.size(); phase++) {
+                cpu[phase] += frame.cpu[phase];
+                if (frame.gpu[phase] >= 0) {
+                    gpu[phase] += frame.gpu[phase];
+                    gpuFrames[phase]++;
+                }
+            }
+        }
+        
+        // Frame-to-frame time includes vsync and event handling, which
+        // begin-to-end time doesn't.
+        const Frame &last = *finishedFrame(first + n - 1);
+        double interval = n > 1 ? (last.begin - finishedFrame(first)->begin) / (double)(n - 1) : frameTime;
+        text << "frame " << last.index << "  "
+             << ofToString(interval * 1e-6, 2) << " ms/frame ("
+             << ofToString(interval > 0 ? 1e9 / interval : 0, 0) << " fps), "
+             << ofToString(frameTime / n * 1e-6, 2) << " ms busy\n";
+        for (size_t phase = 0; phase < phaseNames.size(); phase++) {
+            text << phaseNames[phase] << ": cpu " << ofToString(cpu[phase] / n * 1e-6, 3) << " ms";
+            if (gpuFrames[phase] > 0) {
+                text << ", gpu " << ofToString(gpu[phase] / gpuFrames[phase] * 1e-6, 3) << " ms";
+            }
+            text << "\n";
+        }
+        for (size_t counter = 0; counter < counterNames.size(); counter++) {
+            text << counterNames[counter] << ": " << last.counters[counter] << "\n";
+        }
+    }
+    ofDrawBitmapStringHighlight(text.str(), x, y);
+}
+
+bool FrameProfiler::writeCsv(const std::string &path) {
+    std::ofstream file(path);
+    if (!file) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    file << "frame,frame_ms";
+    for (const std::string &name: phaseNames) {
+        file << "," << name << "_cpu_ms";
+    }
+    for (const std::string &name: phaseNames) {
+        file << "," << name << "_gpu_ms";
+    }
+    for (const std::string &name: counterNames) {
+        file << "," << name;
+    }
+    file << "\n";
+    
+    uint64_t first;
+    int n = lastFinished((int)frames.size(), first);
+    for (uint64_t index = first; index < first + n; index++) {
+        const Frame &frame = *finishedFrame(index);
+        file << frame.index << "," << (frame.end - frame.begin) * 1e-6;
+        for (int64_t cpu: frame.cpu) {
+            file << "," << cpu * 1e-6;
+        }
+        for (int64_t gpu: frame.gpu) {
+            file << ",";
+            if (gpu >= 0) {
+                file << gpu * 1e-6;
+            }
+        }
+        for (int64_t counter: frame.counters) {
+            file << "," << counter;
+        }
+        file << "\n";
+    }
+    return (bool)file;
+}
+
+bool FrameProfiler::writeChromeTrace(const std::string &path) {
+    std::ofstream file(path);
+    if (!file) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    // Timestamps are in microseconds. GPU times have no start on the CPU
+    // clock, so they're counter tracks alongside the CPU spans.
+    file << "{\"traceEvents\":[\n";
+    file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"CircleTree\"}}";
+    
+    uint64_t first;
+    int n = lastFinished((int)frames.size(), first);
+    for (uint64_t index = first; index < first + n; index++) {
+        const Frame &frame = *finishedFrame(index);
+        file << ",\n{\"name\":\"frame " << frame.index << "\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":\"frames\""
+             << ",\"ts\":" << frame.begin / 1000.0 << ",\"dur\":" << (frame.end - frame.begin) / 1000.0 << "}";
+        for (const Event &event: frame.events) {
+            file << ",\n{\"name\":\"" << phaseNames[event.phase] << "\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread
+                 << ",\"ts\":" << event.begin / 1000.0 << ",\"dur\":" << (event.end - event.begin) / 1000.0 << "}";
+        }
+        // Phases whose queries were abandoned (-1) are left out, as in the CSV.
+        const char *separator = nullptr;
+        for (size_t phase = 0; phase < phaseNames.size(); phase++) {
+            if (frame.gpu[phase] < 0) {
+                continue;
+            }
+            if (separator == nullptr) {
+                file << ",\n{\"name\":\"gpu ms\",\"ph\":\"C\",\"pid\":1,\"ts\":" << frame.begin / 1000.0 << ",\"args\":{";
+                separator = "";
+            }
+            file << separator << "\"" << phaseNames[phase] << "\":" << frame.gpu[phase] * 1e-6;
+            separator = ",";
+        }
+        if (separator != nullptr) {
+            file << "}}";
+        }
+        for (size_t counter = 0; counter < counterNames.size(); counter++) {
+            file << ",\n{\"name\":\"" << counterNames[counter] << "\",\"ph\":\"C\",\"pid\":1,\"ts\":" << frame.begin / 1000.0
+                 << ",\"args\":{\"value\":" << frame.counters[counter] << "}}";
+        }
+    }
+    file << "\n]}\n";
+    return (bool)file;
+}
@@ -0,0 +1,108 @@
+//
+//  FrameProfiler.hpp
+//  CircleTree
+//
+
+#ifndef FrameProfiler_hpp
+#define FrameProfiler_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include "ofMain.h"
+
+// Per-frame timings for named phases, on the CPU from any thread and on the
+// GPU through GL timer queries, plus named per-frame counters. The last
+// `capacity` frames are kept in a ring and can be shown as an overlay or
+// written out as CSV and as a Chrome trace (chrome://tracing, Perfetto).
+//
+// Register phases and counters before the first frame. beginFrame, endFrame,
+// GPU scopes and the overlay belong to the GL thread; CPU scopes and counters
+// may be used anywhere and land in whichever frame is open at the time.
+class FrameProfiler {
+public:
+    // Times a phase from construction to destruction. A null profiler makes
+    // it a no-op, so call sites don't need to check.
+    class Scope {
+    public:
+        Scope(FrameProfiler *profiler, int phase, bool gpu = false);
+        ~Scope();
+        
+    private:
+        FrameProfiler *profiler;
+        int phase;
+        bool gpu;
+        int64_t begin;
+    };
+    
+    bool overlayVisible;
+    
+    FrameProfiler(int capacity = 600);
+    ~FrameProfiler();
+    
+    int addPhase(const std::string &name);
+    int addCounter(const std::string &name);
+    
+    void beginFrame();
+    void endFrame();
+    void count(int counter, int64_t value);
+    
+    // Averages over the last `frames` finished frames, in the current
+    // coordinate system.
+    void drawOverlay(float x, float y, int frames = 60);
+    
+    // One row per finished frame in the ring, times in milliseconds. GPU
+    // columns are empty until the queries have come back.
+    bool writeCsv(const std::string &path);
+    bool writeChromeTrace(const std::string &path);
+    
+private:
+    struct Event {
+        int phase;
+        int thread;
+        int64_t begin;
+        int64_t end;
+    };
+    
+    struct Frame {
+        uint64_t index;
+        int64_t begin;
+        int64_t end;
+        std::vector<Event> events;
+        std::vector<int64_t> cpu;
+        std::vector<int64_t> gpu;
+        std::vector<int64_t> counters;
+    };
+    
+    // Queries are read back a few frames late, and only once available, so
+    // the GL thread never waits on the GPU. Each slot belongs to one frame
+    // at a time.
+    struct QuerySlot {
+        uint64_t frame;
+        std::vector<GLuint> queries;
+        std::vector<int> phases;
+    };
+    static const int querySlotCount = 4;
+    
+    std::vector<std::string> phaseNames;
+    std::vector<std::string> counterNames;
+    std::vector<Frame> frames;
+    uint64_t frameCount;
+    std::mutex mutex;
+    int64_t epoch;
+    
+    QuerySlot querySlots[querySlotCount];
+    bool gpuActive;
+    
+    int64_t now() const;
+    Frame &current();
+    Frame *finishedFrame(uint64_t index);
+    void record(int phase, int64_t begin, int64_t end);
+    bool beginGpu(int phase);
+    void endGpu();
+    void collectQueries(QuerySlot &slot);
+    int lastFinished(int frames, uint64_t &first);
+};
+
+#endif /* FrameProfiler_hpp */
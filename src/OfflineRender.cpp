@@ -0,0 +1,242 @@
+//
+//  OfflineRender.cpp
+//  CircleTree
+//
+
+#include "OfflineRender.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+OfflineRenderSettings::OfflineRenderSettings():
+depth(4),
+size(0),
+seed(1),
+width(1500),
+height(1000),
+lodPixelRadius(0.5),
+frames(600),
+timeStep(1.0 / 120),
+output("frames"),
+format("png"),
+encoderThreads(0),
+queueLength(16),
+software(false),
+forest(0),
+simulationRate(0)
+{}
+
+bool OfflineRenderSettings::parse(int argc, char *argv[]) {
+    bool render = false;
+    for (int i = 1; i < argc; i++) {
+        render = render || std::string(argv[i]) == "--render";
+    }
+    if (!render) {
+        return false;
+    }
+    
+    for (int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (option == "--render") {
+            continue;
+        } else if (option == "--depth" && hasValue) {
+            depth = ofToInt(argv[++i]);
+        } else if (option == "--size" && hasValue) {
+            size = ofToInt(argv[++i]);
+        } else if (option == "--seed" && hasValue) {
+            const char *value = argv[++i];
+            char *end = nullptr;
+            errno = 0;
+            unsigned long long parsed = strtoull(value, &end, 10);
+            if (end == value || *end != '\0' || errno == ERANGE || *value == '-') {
+                ofLogWarning("OfflineRender") << "ignoring seed " << value << ", usage: " << usage();
+            } else {
+                seed = parsed;
+            }
+        } else if (option == "--width" && hasValue) {
+            width = ofToInt(argv[++i]);
+        } else if (option == "--height" && hasValue) {
+            height = ofToInt(argv[++i]);
+        } else if (option == "--lod" && hasValue) {
+            lodPixelRadius = ofToFloat(argv[++i]);
+        } else if (option == "--frames" && hasValue) {
+            frames = ofToInt(argv[++i]);
+        } else if (option == "--dt" && hasValue) {
+            timeStep = ofToFloat(argv[++i]);
+        } else if (option == "--out" && hasValue) {
+            output = argv[++i];
+        } else if (option == "--format" && hasValue) {
+            format = argv[++i];
+        } else if (option == "--encoders" && hasValue) {
+            encoderThreads = ofToInt(argv[++i]);
+        } else if (option == "--queue" && hasValue) {
+            queueLength = ofToInt(argv[++i]);
+        } else if (option == "--software") {
+            software = true;
+        } else if (option == "--tree" && hasValue) {
+            tree = argv[++i];
+        } else if (option == "--track" && hasValue) {
+            track = argv[++i];
+        } else if (option == "--animators" && hasValue) {
+            animators = argv[++i];
+        } else if (option == "--forest" && hasValue) {
+            forest = ofToInt(argv[++i]);
+        } else if (option == "--sim-rate" && hasValue) {
+            simulationRate = ofToFloat(argv[++i]);
+        } else {
+            ofLogWarning("OfflineRender") << "ignoring argument " << option << ", usage: " << usage();
+        }
+    }
+    return true;
+}
+
+std::string OfflineRenderSettings::usage() {
+    return "--render [--depth n] [--size px] [--seed n] [--width px] [--height px] [--lod px] "
+           "[--frames n] [--dt seconds] [--out directory] [--format png|raw] "
+           "[--encoders n] [--queue frames] [--software] [--tree file] [--track file] [--animators file] [--forest n] [--sim-rate hz]";
+}
+
+FrameWriter::FrameWriter(const std::string &directory, const std::string &format, int threads, int queueLength):
+directory(directory),
+format(format),
+queueLength(std::max(queueLength, 1)),
+finished(false)
+{
+    if (threads <= 0) {
+        threads = std::max(1, (int)std::thread::hardware_concurrency() / 2);
+    }
+    for (int i = 0; i < threads; i++) {
+        this->threads.push_back(std::thread(&FrameWriter::encodeLoop, this));
+    }
+}
+
+FrameWriter::~FrameWriter() {
+    finish();
+}
+
+void FrameWriter::write(int index, ofPixels &pixels) {
+    std::unique_lock<std::mutex> lock(mutex);
+    frameTaken.wait(lock, [this]() { return (int)frames.size() < queueLength; });
+    frames.push_back(Frame());
+    frames.back().index = index;
+    frames.back().pixels.swap(pixels);
+    lock.unlock();
+    frameQueued.notify_one();
+}
+
+void FrameWriter::finish() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (finished) {
+            return;
+        }
+        finished = true;
+    }
+    frameQueued.notify_all();
+    for (std::thread &thread: threads) {
+        thread.join();
+    }
+}
+
+void FrameWriter::encodeLoop() {
+    while (true) {
+        Frame frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            frameQueued.wait(lock, [this]() { return !frames.empty() || finished; });
+            if (frames.empty()) {
+                return;
+            }
+            frame.index = frames.front().index;
+            frame.pixels.swap(frames.front().pixels);
+            frames.pop_front();
+        }
+        frameTaken.notify_one();
+        encode(frame);
+    }
+}
+
+void FrameWriter::encode(Frame &frame) {
+    std::ostringstream path;
+    path << directory << "/frame_" << std::setw(6) << std::setfill('0') << frame.index << "." << (format == "raw" ? "rgba" : format);
+    
+    if (format == "raw") {
+        std::ofstream file(path.str(), std::ios::binary);
+        file.write((const char *)frame.pixels.getData(), frame.pixels.getTotalBytes());
+        if (!file) {
+            ofLogError("OfflineRender") << "couldn't write " << path.str();
+        }
+    } else if (!ofSaveImage(frame.pixels, path.str())) {
+        ofLogError("OfflineRender") << "couldn't write " << path.str();
+    }
+}
+
+OfflineRenderApp::OfflineRenderApp(OfflineRenderSettings settings):
+settings(settings),
+frame(0)
+{
+    windowWidth = settings.width;
+    windowHeight = settings.height;
+    treeDepth = settings.depth;
+    treeSize = settings.size;
+    randomSeed = settings.seed;
+    lodPixelRadius = settings.lodPixelRadius;
+    softwareRendering = settings.software;
+    treeFile = settings.tree;
+    trackFile = settings.track;
+    animatorFile = settings.animators;
+    forestSize = settings.forest;
+    simulationRate = settings.simulationRate;
+}
+
+void OfflineRenderApp::setup() {
+    ofApp::setup();
+    ofSetFrameRate(0);
+    ofSetVerticalSync(false);
+    
+    if (!settings.software) {
+        target.allocate(ofGetWidth(), ofGetHeight(), GL_RGBA);
+    }
+    ofDirectory::createDirectory(settings.output, false, true);
+    writer.reset(new FrameWriter(settings.output, settings.format, settings.encoderThreads, settings.queueLength));
+    ofLogNotice("OfflineRender") << "rendering " << settings.frames << " frames to " << settings.output;
+}
+
+void OfflineRenderApp::update() {
+    if (frame >= settings.frames) {
+        writer->finish();
+        ofExit();
+        return;
+    }
+    ofApp::update();
+}
+
+void OfflineRenderApp::draw() {
+    if (frame >= settings.frames) {
+        return;
+    }
+    
+    if (settings.software) {
+        drawSoftware(pixels);
+    } else {
+        target.begin();
+        ofClear(255, 255, 255, 255);
+        ofApp::draw();
+        target.end();
+        target.readToPixels(pixels);
+    }
+    writer->write(frame, pixels);
+    frame++;
+}
+
+float OfflineRenderApp::animationTime(uint64_t frame) {
+    return settings.simulationRate > 0 ? ofApp::animationTime(frame) : frame * settings.timeStep;
+}
+
+// Frames are a fixed step of animation time apart, however long they take.
+double OfflineRenderApp::frameDuration() {
+    return settings.timeStep;
+}
@@ -0,0 +1,110 @@
+//
+//  OfflineRender.hpp
+//  CircleTree
+//
+
+#ifndef OfflineRender_hpp
+#define OfflineRender_hpp
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "ofApp.h"
+
+struct OfflineRenderSettings {
+public:
+    int depth;
+    int size;
+    uint64_t seed;
+    int width;
+    int height;
+    // Screen-space LOD threshold in pixels; 0 draws every node.
+    float lodPixelRadius;
+    int frames;
+    float timeStep;
+    std::string output;
+    // "png", or "raw" for headerless RGBA8 frames.
+    std::string format;
+    int encoderThreads;
+    // Frames allowed to wait for an encoder before the render loop waits.
+    int queueLength;
+    // Rasterize on the CPU with SoftwareCanvas, without a window or GL.
+    bool software;
+    // A Tree::save snapshot to render instead of a generated tree.
+    std::string tree;
+    // An AnimationTrack to play instead of running the animators.
+    std::string track;
+    // An AnimatorScript to animate with instead of the built-in animators.
+    std::string animators;
+    // Trees in forest mode; 0 renders the single tree.
+    int forest;
+    // Fixed simulation steps per second of animation time, interpolated
+    // per frame; 0 simulates exactly one step per frame.
+    float simulationRate;
+    
+    OfflineRenderSettings();
+    
+    // Reads --render and its options from the command line; returns false
+    // when --render isn't present.
+    bool parse(int argc, char *argv[]);
+    
+    static std::string usage();
+};
+
+// Encodes frames on worker threads so the render loop only hands off pixels.
+class FrameWriter {
+public:
+    FrameWriter(const std::string &directory, const std::string &format, int threads, int queueLength);
+    ~FrameWriter();
+    
+    void write(int index, ofPixels &pixels);
+    // Waits until every queued frame is on disk.
+    void finish();
+    
+private:
+    struct Frame {
+        int index;
+        ofPixels pixels;
+    };
+    
+    std::string directory;
+    std::string format;
+    int queueLength;
+    std::deque<Frame> frames;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable frameQueued;
+    std::condition_variable frameTaken;
+    bool finished;
+    
+    void encodeLoop();
+    void encode(Frame &frame);
+};
+
+// Runs the regular scene uncapped into an offscreen target and streams each
+// frame to a numbered image sequence, with time advancing a fixed step per
+// frame instead of following the wall clock.
+class OfflineRenderApp: public ofApp {
+public:
+    OfflineRenderApp(OfflineRenderSettings settings);
+    
+    void setup() override;
+    void update() override;
+    void draw() override;
+    
+    float animationTime(uint64_t frame) override;
+    double frameDuration() override;
+    
+private:
+    OfflineRenderSettings settings;
+    int frame;
+    ofFbo target;
+    ofPixels pixels;
+    std::unique_ptr<FrameWriter> writer;
+};
+
+#endif /* OfflineRender_hpp */
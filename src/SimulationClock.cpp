@@ -0,0 +1,46 @@
+//
+//  SimulationClock.cpp
+//  CircleTree
+//
+
+#include "SimulationClock.hpp"
+#include <math.h>
+
+SimulationClock::SimulationClock(double rate, int maxSteps):
+rate(rate),
+maxSteps(maxSteps),
+accumulator(0),
+dropped(0)
+{}
+
+int SimulationClock::advance(double elapsed) {
+    if (rate <= 0) {
+        return 1;
+    }
+    double step = 1 / rate;
+    accumulator += elapsed > 0 ? elapsed : 0;
+    double due = floor(accumulator / step);
+    if (due > maxSteps) {
+        dropped += (uint64_t)(due - maxSteps);
+        accumulator -= (due - maxSteps) * step;
+        due = maxSteps;
+    }
+    accumulator -= due * step;
+    // Rounding can leave a hair under zero.
+    if (accumulator < 0) {
+        accumulator = 0;
+    }
+    return (int)due;
+}
+
+void SimulationClock::reset() {
+    accumulator = 0;
+}
+
+float SimulationClock::alpha() const {
+    if (rate <= 0) {
+        return 1;
+    }
+    float fraction = (float)(accumulator * rate);
+    return fraction < 1 ? fraction : 1;
+}
@@ -0,0 +1,49 @@
+//
+//  SimulationClock.hpp
+//  CircleTree
+//
+
+#ifndef SimulationClock_hpp
+#define SimulationClock_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+
+// A fixed-timestep clock. Each rendered frame feeds it the real time that
+// passed; it answers with how many simulation steps of 1 / rate seconds
+// are due, and how far real time has got past the last of them toward the
+// next, for interpolating between the last two simulated states.
+//
+// With rate 0 it steps exactly once per frame and never interpolates, which
+// ties the simulation to the render rate as before.
+class SimulationClock {
+public:
+    // Steps per second.
+    double rate;
+    // The most steps one advance returns. Time beyond that is dropped, so a
+    // slow frame can't snowball into ever longer catch-ups; the simulation
+    // then runs slower than real time instead.
+    int maxSteps;
+    
+    SimulationClock(double rate = 0, int maxSteps = 8);
+    
+    // Adds elapsed seconds of real time and returns the steps now due.
+    int advance(double elapsed);
+    // Forgets any partial step.
+    void reset();
+    
+    // In [0, 1]: the fraction of a step real time is past the last due one.
+    // 1 with rate 0.
+    float alpha() const;
+    
+    // Steps dropped by maxSteps so far.
+    uint64_t droppedSteps() const {
+        return dropped;
+    }
+    
+private:
+    double accumulator;
+    uint64_t dropped;
+};
+
+#endif /* SimulationClock_hpp */
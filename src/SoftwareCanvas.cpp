@@ -0,0 +1,313 @@
+//
+//  SoftwareCanvas.cpp
+//  CircleTree
+//
+
+#include "SoftwareCanvas.hpp"
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// dst = src * f + dst * (1 - f) over count pixels, where f is src's alpha
+// times coverage: GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA with src's alpha
+// channel blended like the others. One pixel is one 4-wide vector.
+static void blendSpan(float *dst, int count, const float *src, float coverage) {
+    float f = src[3] * coverage;
+#if defined(__SSE2__)
+    __m128 weighted = _mm_mul_ps(_mm_loadu_ps(src), _mm_set1_ps(f));
+    __m128 keep = _mm_set1_ps(1 - f);
+    for (int i = 0; i < count; i++, dst += 4) {
+        _mm_storeu_ps(dst, _mm_add_ps(weighted, _mm_mul_ps(_mm_loadu_ps(dst), keep)));
+    }
+#elif defined(__ARM_NEON)
+    float32x4_t weighted = vmulq_n_f32(vld1q_f32(src), f);
+    float32x4_t keep = vdupq_n_f32(1 - f);
+    for (int i = 0; i < count; i++, dst += 4) {
+        vst1q_f32(dst, vmlaq_f32(weighted, vld1q_f32(dst), keep));
+    }
+#else
+    for (int i = 0; i < count; i++, dst += 4) {
+        for (int c = 0; c < 4; c++) {
+            dst[c] = src[c] * f + dst[c] * (1 - f);
+        }
+    }
+#endif
+}
+
+// The same blend with a per-pixel source, src * tint, whose alpha is f.
+static void blendTinted(float *dst, const float *src, int count, const float *tint) {
+#if defined(__SSE2__)
+    __m128 t = _mm_loadu_ps(tint);
+    __m128 one = _mm_set1_ps(1);
+    for (int i = 0; i < count; i++, dst += 4, src += 4) {
+        __m128 s = _mm_mul_ps(_mm_loadu_ps(src), t);
+        __m128 f = _mm_shuffle_ps(s, s, _MM_SHUFFLE(3, 3, 3, 3));
+        _mm_storeu_ps(dst, _mm_add_ps(_mm_mul_ps(s, f), _mm_mul_ps(_mm_loadu_ps(dst), _mm_sub_ps(one, f))));
+    }
+#elif defined(__ARM_NEON)
+    float32x4_t t = vld1q_f32(tint);
+    for (int i = 0; i < count; i++, dst += 4, src += 4) {
+        float32x4_t s = vmulq_f32(vld1q_f32(src), t);
+        float f = vgetq_lane_f32(s, 3);
+        vst1q_f32(dst, vmlaq_n_f32(vmulq_n_f32(s, f), vld1q_f32(dst), 1 - f));
+    }
+#else
+    for (int i = 0; i < count; i++, dst += 4, src += 4) {
+        float f = src[3] * tint[3];
+        for (int c = 0; c < 4; c++) {
+            dst[c] = src[c] * tint[c] * f + dst[c] * (1 - f);
+        }
+    }
+#endif
+}
+
+SoftwareCanvas::SoftwareCanvas():
+pool(nullptr),
+width(0),
+height(0),
+translateX(0),
+translateY(0),
+scale(1),
+color(1, 1, 1, 1),
+lineColors(nullptr)
+{}
+
+void SoftwareCanvas::allocate(int width, int height) {
+    this->width = max(width, 0);
+    this->height = max(height, 0);
+    pixels.assign((size_t)this->width * this->height * 4, 0);
+    bands.resize(bandCount());
+}
+
+void SoftwareCanvas::clear(const ofFloatColor &color) {
+    auto range = [&](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            float *pixels = row(y);
+            for (int x = 0; x < width * 4; x += 4) {
+                pixels[x] = color.r;
+                pixels[x + 1] = color.g;
+                pixels[x + 2] = color.b;
+                pixels[x + 3] = color.a;
+            }
+        }
+    };
+    if (pool == nullptr) {
+        range(0, height);
+    } else {
+        pool->parallelFor(0, height, bandHeight, range);
+    }
+}
+
+void SoftwareCanvas::setTransform(float x, float y, float scale) {
+    translateX = x;
+    translateY = y;
+    this->scale = scale;
+}
+
+void SoftwareCanvas::setColor(const ofFloatColor &color) {
+    this->color = color;
+}
+
+void SoftwareCanvas::clearBands() {
+    for (std::vector<int> &band: bands) {
+        band.clear();
+    }
+}
+
+void SoftwareCanvas::bin(int index, float left, float top, float right, float bottom) {
+    if (right < 0 || left >= width || bottom < 0 || top >= height) {
+        return;
+    }
+    int first = max((int)floorf(top), 0) / bandHeight;
+    int last = min((int)ceilf(bottom), height - 1) / bandHeight;
+    for (int band = first; band <= last; band++) {
+        bands[band].push_back(index);
+    }
+}
+
+void SoftwareCanvas::forEachBand(const std::function<void(int band, int top, int bottom)> &body) {
+    auto range = [&](int begin, int end) {
+        for (int band = begin; band < end; band++) {
+            if (!bands[band].empty()) {
+                body(band, band * bandHeight, min((band + 1) * bandHeight, height));
+            }
+        }
+    };
+    if (pool == nullptr) {
+        range(0, bandCount());
+    } else {
+        pool->parallelFor(0, bandCount(), 1, range);
+    }
+}
+
+void SoftwareCanvas::fillCircles(const Circle *circles, int count) {
+    this->circles.resize(count);
+    clearBands();
+    for (int i = 0; i < count; i++) {
+        Circle &circle = this->circles[i];
+        circle.x = translateX + circles[i].x * scale;
+        circle.y = translateY + circles[i].y * scale;
+        circle.radius = circles[i].radius * fabsf(scale);
+        // Coverage reaches half a pixel past the edge.
+        float reach = max(circle.radius, 0.5f) + 0.5f;
+        bin(i, circle.x - reach, circle.y - reach, circle.x + reach, circle.y + reach);
+    }
+    forEachBand([this](int band, int top, int bottom) {
+        for (int i: bands[band]) {
+            fillCircle(this->circles[i], top, bottom);
+        }
+    });
+}
+
+// A pixel is covered by r + 0.5 - d, clamped to [0, 1], for a pixel center d
+// from the center. Rows are an edge ramp on either side of a fully covered
+// span. Circles under half a pixel are drawn at half a pixel and faded by
+// area instead.
+void SoftwareCanvas::fillCircle(const Circle &circle, int top, int bottom) {
+    if (circle.radius <= 0) {
+        return;
+    }
+    float radius = max(circle.radius, 0.5f);
+    float fade = circle.radius < 0.5f ? 4 * circle.radius * circle.radius : 1;
+    float outer = radius + 0.5f;
+    float inner = radius - 0.5f;
+    
+    int firstRow = max(top, (int)floorf(circle.y - outer));
+    int lastRow = min(bottom, (int)ceilf(circle.y + outer));
+    for (int y = firstRow; y < lastRow; y++) {
+        float dy = y + 0.5f - circle.y;
+        float dy2 = dy * dy;
+        if (dy2 >= outer * outer) {
+            continue;
+        }
+        float halfWidth = sqrtf(outer * outer - dy2);
+        int left = max(0, (int)floorf(circle.x - halfWidth));
+        int right = min(width, (int)ceilf(circle.x + halfWidth));
+        int fullLeft = right;
+        int fullRight = right;
+        if (inner > 0 && dy2 < inner * inner) {
+            float innerWidth = sqrtf(inner * inner - dy2);
+            fullLeft = max(left, (int)ceilf(circle.x - innerWidth - 0.5f));
+            fullRight = min(right, (int)floorf(circle.x + innerWidth - 0.5f) + 1);
+            if (fullRight <= fullLeft) {
+                fullLeft = fullRight = right;
+            }
+        }
+        
+        float *pixels = row(y);
+        auto edge = [&](int x) {
+            float dx = x + 0.5f - circle.x;
+            float coverage = ofClamp(outer - sqrtf(dx * dx + dy2), 0, 1) * fade;
+            if (coverage > 0) {
+                blendSpan(pixels + x * 4, 1, &color.r, coverage);
+            }
+        };
+        for (int x = left; x < fullLeft; x++) {
+            edge(x);
+        }
+        if (fullRight > fullLeft) {
+            blendSpan(pixels + fullLeft * 4, fullRight - fullLeft, &color.r, fade);
+        }
+        for (int x = fullRight; x < right; x++) {
+            edge(x);
+        }
+    }
+}
+
+void SoftwareCanvas::drawLines(const glm::vec3 *vertices, const ofFloatColor *colors, int lineCount) {
+    lines.resize(lineCount);
+    lineColors = colors;
+    clearBands();
+    for (int i = 0; i < lineCount; i++) {
+        Line &line = lines[i];
+        line.x0 = translateX + vertices[i * 2].x * scale;
+        line.y0 = translateY + vertices[i * 2].y * scale;
+        line.x1 = translateX + vertices[i * 2 + 1].x * scale;
+        line.y1 = translateY + vertices[i * 2 + 1].y * scale;
+        line.color = i * 2;
+        bin(i, min(line.x0, line.x1) - 1, min(line.y0, line.y1) - 1, max(line.x0, line.x1) + 1, max(line.y0, line.y1) + 1);
+    }
+    forEachBand([this](int band, int top, int bottom) {
+        for (int i: bands[band]) {
+            drawLine(lines[i], top, bottom);
+        }
+    });
+}
+
+// A one-pixel line covers 1 - d of a pixel whose center is d from the
+// segment, so each row is scanned only where that is positive.
+void SoftwareCanvas::drawLine(const Line &line, int top, int bottom) {
+    float dx = line.x1 - line.x0;
+    float dy = line.y1 - line.y0;
+    float length2 = dx * dx + dy * dy;
+    float minX = min(line.x0, line.x1) - 1;
+    float maxX = max(line.x0, line.x1) + 1;
+    const float *color = &lineColors[line.color].r;
+    
+    int firstRow = max(top, (int)floorf(min(line.y0, line.y1) - 1));
+    int lastRow = min(bottom, (int)ceilf(max(line.y0, line.y1) + 1));
+    for (int y = firstRow; y < lastRow; y++) {
+        float py = y + 0.5f;
+        float left = minX;
+        float right = maxX;
+        if (fabsf(dy) > 1e-3f) {
+            // Where the line crosses the row, widened by the one-pixel reach
+            // measured along x.
+            float x = line.x0 + (py - line.y0) * dx / dy;
+            float reach = sqrtf(length2) / fabsf(dy);
+            left = max(left, x - reach);
+            right = min(right, x + reach);
+        }
+        
+        float *pixels = row(y);
+        int lastColumn = min(width, (int)ceilf(right));
+        for (int x = max(0, (int)floorf(left)); x < lastColumn; x++) {
+            float px = x + 0.5f;
+            float t = length2 > 0 ? ofClamp(((px - line.x0) * dx + (py - line.y0) * dy) / length2, 0, 1) : 0;
+            float ex = px - (line.x0 + t * dx);
+            float ey = py - (line.y0 + t * dy);
+            float coverage = 1 - sqrtf(ex * ex + ey * ey);
+            if (coverage > 0) {
+                blendSpan(pixels + x * 4, 1, color, coverage);
+            }
+        }
+    }
+}
+
+void SoftwareCanvas::draw(const SoftwareCanvas &other) {
+    int columns = min(width, other.width);
+    int rows = min(height, other.height);
+    if (columns <= 0 || rows <= 0) {
+        return;
+    }
+    auto range = [&](int begin, int end) {
+        for (int y = begin; y < end; y++) {
+            blendTinted(row(y), other.pixels.data() + (size_t)y * other.width * 4, columns, &color.r);
+        }
+    };
+    if (pool == nullptr) {
+        range(0, rows);
+    } else {
+        pool->parallelFor(0, rows, bandHeight, range);
+    }
+}
+
+void SoftwareCanvas::readToPixels(ofPixels &pixels) const {
+    pixels.allocate(width, height, OF_PIXELS_RGBA);
+    unsigned char *data = pixels.getData();
+    const float *source = this->pixels.data();
+    auto range = [&](int begin, int end) {
+        for (size_t i = (size_t)begin * width * 4; i < (size_t)end * width * 4; i++) {
+            data[i] = (unsigned char)(ofClamp(source[i], 0, 1) * 255 + 0.5f);
+        }
+    };
+    if (pool == nullptr) {
+        range(0, height);
+    } else {
+        pool->parallelFor(0, height, bandHeight, range);
+    }
+}
@@ -0,0 +1,106 @@
+//
+//  SoftwareCanvas.hpp
+//  CircleTree
+//
+
+#ifndef SoftwareCanvas_hpp
+#define SoftwareCanvas_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <functional>
+#include "ofMain.h"
+#include "ThreadPool.hpp"
+
+// A framebuffer drawn on the CPU, for rendering without a GL context (render
+// nodes without a GPU). Pixels are straight-alpha RGBA floats with y down,
+// like an ofFbo. Blending matches OF's default alpha mode, glBlendFunc(
+// GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA) on all four channels, and shapes are
+// antialiased by how much of each pixel they cover.
+//
+// Each batch is binned into bands of rows that are rasterized in parallel on
+// the pool. A band draws its primitives in submission order, so the result
+// doesn't depend on the thread count.
+class SoftwareCanvas {
+public:
+    struct Circle {
+        float x;
+        float y;
+        float radius;
+    };
+    
+    ThreadPool *pool;
+    
+    SoftwareCanvas();
+    
+    void allocate(int width, int height);
+    
+    int getWidth() const {
+        return width;
+    }
+    
+    int getHeight() const {
+        return height;
+    }
+    
+    void clear(const ofFloatColor &color);
+    
+    // Like ofTranslate(x, y) then ofScale(scale, scale) from the identity.
+    void setTransform(float x, float y, float scale);
+    // Like ofSetColor: circles are filled with it and draw() tints by it.
+    void setColor(const ofFloatColor &color);
+    
+    void fillCircles(const Circle *circles, int count);
+    // One-pixel lines between vertex pairs, each in its first vertex's
+    // color, as an OF_PRIMITIVE_LINES mesh draws them.
+    void drawLines(const glm::vec3 *vertices, const ofFloatColor *colors, int lineCount);
+    // Blends other over this canvas pixel for pixel from the top left
+    // corner, ignoring the transform, tinted by the current color, as
+    // ofFbo::draw(0, 0) does.
+    void draw(const SoftwareCanvas &other);
+    
+    void readToPixels(ofPixels &pixels) const;
+    
+private:
+    struct Line {
+        float x0;
+        float y0;
+        float x1;
+        float y1;
+        int color;
+    };
+    
+    static const int bandHeight = 32;
+    
+    int width;
+    int height;
+    std::vector<float> pixels;
+    float translateX;
+    float translateY;
+    float scale;
+    ofFloatColor color;
+    
+    // Primitives of the current batch, in canvas space, and the indices of
+    // those touching each band.
+    std::vector<Circle> circles;
+    std::vector<Line> lines;
+    const ofFloatColor *lineColors;
+    std::vector<std::vector<int>> bands;
+    
+    int bandCount() const {
+        return (height + bandHeight - 1) / bandHeight;
+    }
+    
+    float *row(int y) {
+        return pixels.data() + (size_t)y * width * 4;
+    }
+    
+    void clearBands();
+    void bin(int index, float left, float top, float right, float bottom);
+    void forEachBand(const std::function<void(int band, int top, int bottom)> &body);
+    
+    void fillCircle(const Circle &circle, int top, int bottom);
+    void drawLine(const Line &line, int top, int bottom);
+};
+
+#endif /* SoftwareCanvas_hpp */
@@ -0,0 +1,262 @@
+//
+//  SpatialIndex.cpp
+//  CircleTree
+//
+
+#include "SpatialIndex.hpp"
+#include "Forest.hpp"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+SpatialIndex::SpatialIndex():
+tree(nullptr),
+hierarchy(nullptr),
+left(0),
+top(0)
+{}
+
+void SpatialIndex::update(const Tree *tree, const RenderedTree &renderedTree) {
+    this->tree = tree;
+    int count = renderedTree.count();
+    if (tree->nodes.count() == count && (int)renderedTree.bounds.size() == count) {
+        hierarchy = &renderedTree;
+        circles.clear();
+        build();
+        return;
+    }
+    hierarchy = nullptr;
+    float radius = renderedTree.size / 2;
+    circles.resize(count);
+    for (int node = 0; node < count; node++) {
+        const RenderedTreeNode &rendered = renderedTree.nodes[node];
+        circles[node] = { rendered.position.x, rendered.position.y, fabsf(radius * rendered.scale) };
+    }
+    build();
+}
+
+void SpatialIndex::update(const Forest &forest) {
+    tree = forest.tree;
+    hierarchy = nullptr;
+    float radius = forest.tree->size / 2;
+    const std::vector<ForestNode> &nodes = forest.nodes();
+    circles.resize(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++) {
+        circles[i] = { nodes[i].x, nodes[i].y, fabsf(radius * nodes[i].scale) };
+    }
+    build();
+}
+
+// The binary exponent of a positive float, from its bits.
+static inline int exponent(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (int)(bits >> 23);
+}
+
+void SpatialIndex::build() {
+    int count = (int)circles.size();
+    levels.clear();
+    if (count == 0) {
+        cellStarts.assign(1, 0);
+        cellIds.clear();
+        cellCircles.clear();
+        return;
+    }
+    
+    float right = circles[0].x;
+    float bottom = circles[0].y;
+    float maxRadius = 0;
+    left = circles[0].x;
+    top = circles[0].y;
+    for (const Circle &circle: circles) {
+        left = min(left, circle.x);
+        right = max(right, circle.x);
+        top = min(top, circle.y);
+        bottom = max(bottom, circle.y);
+        maxRadius = max(maxRadius, circle.radius);
+    }
+    
+    // Level i holds the radii with binary exponents i below the largest's;
+    // the last level also takes everything smaller.
+    levels.assign(maxLevels, Level());
+    for (Level &level: levels) {
+        level.maxRadius = 0;
+        level.count = 0;
+    }
+    keys.resize(count);
+    int maxExponent = exponent(maxRadius);
+    for (int id = 0; id < count; id++) {
+        float radius = circles[id].radius;
+        int index = radius > 0 ? min(maxExponent - exponent(radius), maxLevels - 1) : maxLevels - 1;
+        keys[id] = index;
+        levels[index].count++;
+        levels[index].maxRadius = max(levels[index].maxRadius, radius);
+    }
+    
+    // Cells twice the largest radius across, but no smaller than the level's
+    // circles spread evenly over the bounds would make them, so sparse
+    // levels of tiny circles don't get millions of empty cells.
+    float width = right - left;
+    float height = bottom - top;
+    int firstCell = 0;
+    for (Level &level: levels) {
+        level.firstCell = firstCell;
+        if (level.count == 0) {
+            level.columns = 0;
+            level.rows = 0;
+            continue;
+        }
+        float cellSize = max(2 * level.maxRadius, sqrtf(width * height / level.count));
+        if (!(cellSize > 0)) {
+            cellSize = max(max(width, height), 1.0f);
+        }
+        while ((width / cellSize + 1) * (height / cellSize + 1) > 4.0f * level.count + 16) {
+            cellSize *= 2;
+        }
+        level.inverseCellSize = 1 / cellSize;
+        level.columns = (int)(width * level.inverseCellSize) + 1;
+        level.rows = (int)(height * level.inverseCellSize) + 1;
+        firstCell += level.columns * level.rows;
+    }
+    
+    // Counting sort of the circles by cell.
+    cellStarts.assign(firstCell + 1, 0);
+    for (int id = 0; id < count; id++) {
+        const Circle &circle = circles[id];
+        const Level &level = levels[keys[id]];
+        int column = min((int)((circle.x - left) * level.inverseCellSize), level.columns - 1);
+        int row = min((int)((circle.y - top) * level.inverseCellSize), level.rows - 1);
+        keys[id] = level.firstCell + row * level.columns + column;
+        cellStarts[keys[id] + 1]++;
+    }
+    for (int cell = 0; cell < firstCell; cell++) {
+        cellStarts[cell + 1] += cellStarts[cell];
+    }
+    cellIds.resize(count);
+    cellCircles.resize(count);
+    // Filling each cell from its end, in reverse, keeps ids ascending within
+    // it and leaves cellStarts[cell + 1] at the cell's start.
+    for (int id = count - 1; id >= 0; id--) {
+        int slot = --cellStarts[keys[id] + 1];
+        cellIds[slot] = id;
+        cellCircles[slot] = circles[id];
+    }
+    for (int cell = 0; cell < firstCell; cell++) {
+        cellStarts[cell] = cellStarts[cell + 1];
+    }
+    cellStarts[firstCell] = count;
+}
+
+template <typename Reaches, typename Visit>
+void SpatialIndex::visitRegion(float regionLeft, float regionTop, float regionRight, float regionBottom, Reaches reaches, Visit visit) const {
+    if (hierarchy != nullptr) {
+        if (hierarchy->count() == 0 || !reaches(hierarchy->bounds[Tree::root])) {
+            return;
+        }
+        const TreeNodes &nodes = tree->nodes;
+        float radius = hierarchy->size / 2;
+        pending.resize(1);
+        pending[0] = Tree::root;
+        while (!pending.empty()) {
+            int node = pending.back();
+            pending.pop_back();
+            const RenderedTreeNode &rendered = hierarchy->nodes[node];
+            visit(node, rendered.position.x, rendered.position.y, fabsf(radius * rendered.scale));
+            int first = nodes.firstChild[node];
+            int last = first + nodes.childCount[node];
+            for (int child = first; child < last; child++) {
+                if (reaches(hierarchy->bounds[child])) {
+                    pending.push_back(child);
+                }
+            }
+        }
+        return;
+    }
+    
+    for (const Level &level: levels) {
+        if (level.count == 0) {
+            continue;
+        }
+        float reach = level.maxRadius;
+        float inverse = level.inverseCellSize;
+        int firstColumn = (int)floorf((regionLeft - reach - left) * inverse);
+        int lastColumn = (int)floorf((regionRight + reach - left) * inverse);
+        int firstRow = (int)floorf((regionTop - reach - top) * inverse);
+        int lastRow = (int)floorf((regionBottom + reach - top) * inverse);
+        if (lastColumn < 0 || lastRow < 0 || firstColumn >= level.columns || firstRow >= level.rows) {
+            continue;
+        }
+        firstColumn = max(firstColumn, 0);
+        lastColumn = min(lastColumn, level.columns - 1);
+        firstRow = max(firstRow, 0);
+        lastRow = min(lastRow, level.rows - 1);
+        for (int row = firstRow; row <= lastRow; row++) {
+            // A row's cells are consecutive.
+            int rowCell = level.firstCell + row * level.columns;
+            int end = cellStarts[rowCell + lastColumn + 1];
+            for (int i = cellStarts[rowCell + firstColumn]; i < end; i++) {
+                const Circle &circle = cellCircles[i];
+                visit(cellIds[i], circle.x, circle.y, circle.radius);
+            }
+        }
+    }
+}
+
+int SpatialIndex::nodeAt(float x, float y) const {
+    int found = -1;
+    auto reaches = [&](const BoundingCircle &bounds) {
+        float dx = bounds.x - x;
+        float dy = bounds.y - y;
+        return bounds.radius >= 0 && dx * dx + dy * dy <= bounds.radius * bounds.radius;
+    };
+    visitRegion(x, y, x, y, reaches, [&](int id, float circleX, float circleY, float circleRadius) {
+        float dx = circleX - x;
+        float dy = circleY - y;
+        if (id > found && dx * dx + dy * dy <= circleRadius * circleRadius) {
+            found = id;
+        }
+    });
+    return found;
+}
+
+void SpatialIndex::queryPoint(float x, float y, std::vector<int> &ids) const {
+    queryRadius(x, y, 0, ids);
+}
+
+void SpatialIndex::queryRadius(float x, float y, float radius, std::vector<int> &ids) const {
+    ids.clear();
+    auto reaches = [&](const BoundingCircle &bounds) {
+        float dx = bounds.x - x;
+        float dy = bounds.y - y;
+        float reach = bounds.radius + radius;
+        return bounds.radius >= 0 && dx * dx + dy * dy <= reach * reach;
+    };
+    visitRegion(x - radius, y - radius, x + radius, y + radius, reaches, [&](int id, float circleX, float circleY, float circleRadius) {
+        float dx = circleX - x;
+        float dy = circleY - y;
+        float reach = circleRadius + radius;
+        if (dx * dx + dy * dy <= reach * reach) {
+            ids.push_back(id);
+        }
+    });
+}
+
+void SpatialIndex::queryRectangle(const ofRectangle &rectangle, std::vector<int> &ids) const {
+    ids.clear();
+    float regionLeft = min(rectangle.x, rectangle.x + rectangle.width);
+    float regionRight = max(rectangle.x, rectangle.x + rectangle.width);
+    float regionTop = min(rectangle.y, rectangle.y + rectangle.height);
+    float regionBottom = max(rectangle.y, rectangle.y + rectangle.height);
+    ofRectangle region(regionLeft, regionTop, regionRight - regionLeft, regionBottom - regionTop);
+    auto reaches = [&](const BoundingCircle &bounds) {
+        return bounds.intersects(region);
+    };
+    visitRegion(regionLeft, regionTop, regionRight, regionBottom, reaches, [&](int id, float circleX, float circleY, float circleRadius) {
+        float dx = circleX - ofClamp(circleX, regionLeft, regionRight);
+        float dy = circleY - ofClamp(circleY, regionTop, regionBottom);
+        if (dx * dx + dy * dy <= circleRadius * circleRadius) {
+            ids.push_back(id);
+        }
+    });
+}
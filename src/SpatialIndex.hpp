@@ -0,0 +1,109 @@
+//
+//  SpatialIndex.hpp
+//  CircleTree
+//
+
+#ifndef SpatialIndex_hpp
+#define SpatialIndex_hpp
+
+#include <stdio.h>
+#include <vector>
+#include "Trees.hpp"
+
+class Forest;
+
+// Finds the nodes whose circles lie at a point or in a region of one
+// rendered frame, without scanning them all. Circles are radius size / 2
+// times each node's scale, as the circle drawers draw them.
+//
+// A RenderedTree with bounds is already a bounding volume hierarchy: each
+// node's bounds enclose its subtree, and TreeRenderer refits them every
+// frame, recomputing only the nodes that moved. Queries on one start at the
+// root and only descend into children whose bounds reach the region, so
+// indexing it costs nothing.
+//
+// Anything else, a snapshot without bounds or a forest, is indexed with a
+// grid. Circles are split into levels by radius, every radius of a level
+// below every radius of the level above. Each level is a uniform grid with
+// cells at least twice its largest radius across, and every circle is
+// stored once, in the cell of its center, so a query visits, per level, the
+// cells within that level's largest radius of its region. Building it is
+// two counting passes over the circles and allocates nothing once its
+// arrays have grown to the frame's size.
+class SpatialIndex {
+public:
+    SpatialIndex();
+    
+    // Indexes a snapshot of tree. Ids are node indices. A snapshot with
+    // bounds is used in place and must outlive the queries.
+    void update(const Tree *tree, const RenderedTree &renderedTree);
+    // Ids index forest.nodes().
+    void update(const Forest &forest);
+    
+    // Whether queries descend a snapshot's bounds rather than the grid.
+    bool usesHierarchy() const {
+        return hierarchy != nullptr;
+    }
+    
+    // The highest id of the circles containing the point, or -1 when there
+    // are none. Tree ids are breadth-first, so that's a deepest node; it
+    // isn't necessarily the one drawn on top, since the batch drawers
+    // order by LOD bucket and the immediate-mode drawers go depth-first.
+    int nodeAt(float x, float y) const;
+    // Replace ids' contents with the nodes, in no particular order, whose
+    // circles contain the point, intersect the disc, or intersect the
+    // rectangle.
+    void queryPoint(float x, float y, std::vector<int> &ids) const;
+    void queryRadius(float x, float y, float radius, std::vector<int> &ids) const;
+    void queryRectangle(const ofRectangle &rectangle, std::vector<int> &ids) const;
+    
+private:
+    static const int maxLevels = 24;
+    
+    struct Circle {
+        float x;
+        float y;
+        float radius;
+    };
+    
+    struct Level {
+        // No circle of the level reaches further from its center.
+        float maxRadius;
+        float inverseCellSize;
+        int columns;
+        int rows;
+        // Where the level's cells start in cellStarts.
+        int firstCell;
+        int count;
+    };
+    
+    const Tree *tree;
+    // The snapshot queries descend, when it has bounds.
+    const RenderedTree *hierarchy;
+    // The nodes left to descend into, kept between queries so they don't
+    // allocate. Queries on one index mustn't run at once.
+    mutable std::vector<int> pending;
+    
+    // The grid. By id, then cell by cell, so queries read the circles of
+    // a cell in order.
+    std::vector<Circle> circles;
+    std::vector<int> cellIds;
+    std::vector<Circle> cellCircles;
+    // cellStarts[cell] to cellStarts[cell + 1] index cellIds.
+    std::vector<int> cellStarts;
+    // Per circle while building: its level, then its cell.
+    std::vector<int> keys;
+    std::vector<Level> levels;
+    // The corner of every level's grid.
+    float left;
+    float top;
+    
+    void build();
+    // Calls visit(id, x, y, radius) with every circle that might meet the
+    // region, given by its bounding box; reaches(bounds) says whether a
+    // bounding circle does. visit does the exact test.
+    template <typename Reaches, typename Visit>
+    void visitRegion(float regionLeft, float regionTop, float regionRight, float regionBottom, Reaches reaches, Visit visit) const;
+};
+
+#endif /* SpatialIndex_hpp */
@@ -0,0 +1,228 @@
+//
+//  StaticAnimators.hpp
+//  CircleTree
+//
+
+#ifndef StaticAnimators_hpp
+#define StaticAnimators_hpp
+
+#include <stdio.h>
+#include <math.h>
+#include <type_traits>
+#include <algorithm>
+#include "Trees.hpp"
+
+// Channel functors for StaticNodeAnimator. Each is a literal type evaluated
+// as channel(v, t), so the animate loop for a given combination of channel
+// types is generated and inlined at compile time rather than going through
+// AnimatorFunction pointers.
+
+// Leaves the value alone. StaticNodeAnimator skips these channels entirely.
+struct ConstantChannel {
+    constexpr ConstantChannel() {}
+    
+    float operator()(float v, float t) const {
+        return v;
+    }
+};
+
+// v + rate every frame.
+struct DriftChannel {
+    float rate;
+    
+    constexpr DriftChannel(float rate): rate(rate) {}
+    
+    float operator()(float v, float t) const {
+        return v + rate;
+    }
+};
+
+// bias + amplitude * sin(timeFrequency * t + valueFrequency * v + phase)
+struct SineChannel {
+    float bias;
+    float amplitude;
+    float timeFrequency;
+    float valueFrequency;
+    float phase;
+    
+    constexpr SineChannel(float bias, float amplitude, float timeFrequency, float valueFrequency = 0, float phase = 0):
+    bias(bias), amplitude(amplitude), timeFrequency(timeFrequency), valueFrequency(valueFrequency), phase(phase) {}
+    
+    float operator()(float v, float t) const {
+        return bias + amplitude * sinf(timeFrequency * t + valueFrequency * v + phase);
+    }
+};
+
+// bias + amplitude * cos(timeFrequency * t + valueFrequency * v + phase)
+struct CosineChannel {
+    float bias;
+    float amplitude;
+    float timeFrequency;
+    float valueFrequency;
+    float phase;
+    
+    constexpr CosineChannel(float bias, float amplitude, float timeFrequency, float valueFrequency = 0, float phase = 0):
+    bias(bias), amplitude(amplitude), timeFrequency(timeFrequency), valueFrequency(valueFrequency), phase(phase) {}
+    
+    float operator()(float v, float t) const {
+        return bias + amplitude * cosf(timeFrequency * t + valueFrequency * v + phase);
+    }
+};
+
+// Evaluates channel against sqrt(t), as in 0.5 + sinf(sqrt(d)) * 0.1.
+template <typename Channel>
+struct SqrtTimeChannel {
+    Channel channel;
+    
+    constexpr SqrtTimeChannel(Channel channel): channel(channel) {}
+    
+    float operator()(float v, float t) const {
+        return channel(v, sqrtf(t));
+    }
+};
+
+// a(v, t) + b(v, t)
+template <typename A, typename B>
+struct SumChannel {
+    A a;
+    B b;
+    
+    constexpr SumChannel(A a, B b): a(a), b(b) {}
+    
+    float operator()(float v, float t) const {
+        return a(v, t) + b(v, t);
+    }
+};
+
+// a(v, t) * b(v, t)
+template <typename A, typename B>
+struct ProductChannel {
+    A a;
+    B b;
+    
+    constexpr ProductChannel(A a, B b): a(a), b(b) {}
+    
+    float operator()(float v, float t) const {
+        return a(v, t) * b(v, t);
+    }
+};
+
+// Whether a channel ignores v, so StaticNodeAnimator can evaluate it once
+// per group and broadcast the result. Channels are assumed to depend on v
+// unless they have an overload here.
+template <typename Channel>
+bool isTimeOnly(const Channel &channel) {
+    return false;
+}
+
+inline bool isTimeOnly(const SineChannel &channel) {
+    return channel.valueFrequency == 0;
+}
+
+inline bool isTimeOnly(const CosineChannel &channel) {
+    return channel.valueFrequency == 0;
+}
+
+template <typename Channel>
+bool isTimeOnly(const SqrtTimeChannel<Channel> &channel) {
+    return isTimeOnly(channel.channel);
+}
+
+template <typename A, typename B>
+bool isTimeOnly(const SumChannel<A, B> &channel) {
+    return isTimeOnly(channel.a) && isTimeOnly(channel.b);
+}
+
+template <typename A, typename B>
+bool isTimeOnly(const ProductChannel<A, B> &channel) {
+    return isTimeOnly(channel.a) && isTimeOnly(channel.b);
+}
+
+// A NodeAnimator whose five channels are fixed at compile time. Constant
+// channels compile away; time-only channels are evaluated once per group and
+// every other channel gets its own tight loop over the animator's group with
+// the functor inlined.
+template <typename Aspect, typename BranchAngle, typename TerminusAngle, typename Size, typename Offset>
+class StaticNodeAnimator: public NodeAnimator {
+public:
+    Aspect aspect;
+    BranchAngle branchAngle;
+    TerminusAngle terminusAngle;
+    Size size;
+    Offset offset;
+    
+    StaticNodeAnimator(Aspect aspect, BranchAngle branchAngle, TerminusAngle terminusAngle, Size size, Offset offset):
+    NodeAnimator(NodeAnimatorFunctions()),
+    aspect(aspect),
+    branchAngle(branchAngle),
+    terminusAngle(terminusAngle),
+    size(size),
+    offset(offset) {
+    }
+    
+    void applyTo(TreeNodes &nodes, int node, float dt) override {
+        applyTo(nodes, &node, 1, nullptr, dt);
+    }
+    
+    void applyTo(TreeNodes &nodes, const int *group, int count, float *scratch, float dt) override {
+        applyChannel(aspect, nodes.aspect, group, count, dt);
+        applyChannel(branchAngle, nodes.branchAngle, group, count, dt);
+        applyChannel(terminusAngle, nodes.terminusAngle, group, count, dt);
+        applyChannel(size, nodes.size, group, count, dt);
+        applyChannel(offset, nodes.offset, group, count, dt);
+    }
+    
+    void applyTo(float *const *fields, int count, float dt) override {
+        applyRange(aspect, fields[0], count, dt);
+        applyRange(branchAngle, fields[1], count, dt);
+        applyRange(terminusAngle, fields[2], count, dt);
+        applyRange(size, fields[3], count, dt);
+        applyRange(offset, fields[4], count, dt);
+    }
+    
+    bool isStatic() const override {
+        return std::is_same<Aspect, ConstantChannel>::value &&
+               std::is_same<BranchAngle, ConstantChannel>::value &&
+               std::is_same<TerminusAngle, ConstantChannel>::value &&
+               std::is_same<Size, ConstantChannel>::value &&
+               std::is_same<Offset, ConstantChannel>::value;
+    }
+    
+private:
+    template <typename Channel>
+    static void applyChannel(const Channel &channel, float *field, const int *group, int count, float dt) {
+        if constexpr (!std::is_same<Channel, ConstantChannel>::value) {
+            if (isTimeOnly(channel)) {
+                float value = channel(0, dt);
+                for (int i = 0; i < count; i++) {
+                    field[group[i]] = value;
+                }
+                return;
+            }
+            for (int i = 0; i < count; i++) {
+                float &value = field[group[i]];
+                value = channel(value, dt);
+            }
+        }
+    }
+    
+    template <typename Channel>
+    static void applyRange(const Channel &channel, float *values, int count, float dt) {
+        if constexpr (!std::is_same<Channel, ConstantChannel>::value) {
+            if (isTimeOnly(channel)) {
+                std::fill(values, values + count, channel(0, dt));
+                return;
+            }
+            for (int i = 0; i < count; i++) {
+                values[i] = channel(values[i], dt);
+            }
+        }
+    }
+};
+
+template <typename Aspect, typename BranchAngle, typename TerminusAngle, typename Size, typename Offset>
+StaticNodeAnimator<Aspect, BranchAngle, TerminusAngle, Size, Offset> *makeStaticNodeAnimator(Aspect aspect, BranchAngle branchAngle, TerminusAngle terminusAngle, Size size, Offset offset) {
+    return new StaticNodeAnimator<Aspect, BranchAngle, TerminusAngle, Size, Offset>(aspect, branchAngle, terminusAngle, size, offset);
+}
+
+#endif /* StaticAnimators_hpp */
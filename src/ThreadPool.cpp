@@ -0,0 +1,182 @@
+//
+//  ThreadPool.cpp
+//  CircleTree
+//
+
+#include "ThreadPool.hpp"
+
+// The pool and worker index of the current thread, so nested run() calls land
+// on the calling worker's own deque.
+static thread_local const ThreadPool *currentPool = nullptr;
+static thread_local int currentWorker = -1;
+
+// Enough for every worker's chunk of a parallelFor before a queue grows.
+static const size_t initialQueueCapacity = 64;
+
+ThreadPool::Queue::Queue():
+tasks(initialQueueCapacity),
+first(0),
+count(0)
+{}
+
+void ThreadPool::Queue::pushBack(Task &&task) {
+    if (count == tasks.size()) {
+        std::vector<Task> grown(tasks.size() * 2);
+        for (size_t i = 0; i < count; i++) {
+            grown[i] = std::move(tasks[(first + i) % tasks.size()]);
+        }
+        tasks.swap(grown);
+        first = 0;
+    }
+    tasks[(first + count) % tasks.size()] = std::move(task);
+    count++;
+}
+
+ThreadPool::Task ThreadPool::Queue::popBack() {
+    count--;
+    return std::move(tasks[(first + count) % tasks.size()]);
+}
+
+ThreadPool::Task ThreadPool::Queue::popFront() {
+    Task task = std::move(tasks[first]);
+    first = (first + 1) % tasks.size();
+    count--;
+    return task;
+}
+
+ThreadPool::ThreadPool(int threadCount):
+queued(0),
+stopping(false)
+{
+    if (threadCount <= 0) {
+        threadCount = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+    }
+    for (int i = 0; i <= threadCount; i++) {
+        queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+    for (int i = 0; i < threadCount; i++) {
+        threads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &thread: threads) {
+        thread.join();
+    }
+}
+
+int ThreadPool::queueIndex() const {
+    return currentPool == this ? currentWorker : (int)queues.size() - 1;
+}
+
+void ThreadPool::run(TaskGroup &group, std::function<void()> task) {
+    Task queuedTask;
+    queuedTask.function = std::move(task);
+    queuedTask.group = &group;
+    push(std::move(queuedTask));
+}
+
+void ThreadPool::push(Task &&task) {
+    task.group->pending++;
+    Queue &queue = *queues[queueIndex()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.pushBack(std::move(task));
+    }
+    queued++;
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wake.notify_one();
+}
+
+bool ThreadPool::runOne(int home) {
+    Task task;
+    bool found = false;
+    
+    // Newest first from our own queue, oldest first from everyone else's.
+    {
+        Queue &queue = *queues[home];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.count > 0) {
+            task = queue.popBack();
+            found = true;
+        }
+    }
+    for (int i = 1; !found && i < (int)queues.size(); i++) {
+        Queue &queue = *queues[(home + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.count > 0) {
+            task = queue.popFront();
+            found = true;
+        }
+    }
+    if (!found) {
+        return false;
+    }
+    
+    queued--;
+    if (task.range != nullptr) {
+        task.range(task.body, task.begin, task.end);
+    } else {
+        task.function();
+    }
+    task.group->pending--;
+    return true;
+}
+
+void ThreadPool::wait(TaskGroup &group) {
+    int home = queueIndex();
+    while (group.pending > 0) {
+        if (!runOne(home)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void ThreadPool::parallelForRange(int begin, int end, int grainSize, RangeFunction range, const void *body) {
+    int count = end - begin;
+    if (count <= 0) {
+        return;
+    }
+    int chunks = std::min(workerCount() + 1, std::max(1, count / std::max(grainSize, 1)));
+    if (chunks == 1) {
+        range(body, begin, end);
+        return;
+    }
+    
+    TaskGroup group;
+    for (int chunk = 1; chunk < chunks; chunk++) {
+        int chunkBegin = begin + (int)((long long)count * chunk / chunks);
+        int chunkEnd = begin + (int)((long long)count * (chunk + 1) / chunks);
+        Task task;
+        task.range = range;
+        task.body = body;
+        task.begin = chunkBegin;
+        task.end = chunkEnd;
+        task.group = &group;
+        push(std::move(task));
+    }
+    range(body, begin, begin + count / chunks);
+    wait(group);
+}
+
+void ThreadPool::workerLoop(int index) {
+    currentPool = this;
+    currentWorker = index;
+    while (true) {
+        if (runOne(index)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this]() { return queued > 0 || stopping; });
+        if (stopping) {
+            return;
+        }
+    }
+}
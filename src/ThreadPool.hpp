@@ -0,0 +1,100 @@
+//
+//  ThreadPool.hpp
+//  CircleTree
+//
+
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+
+// A small work-stealing pool. Each worker pushes and pops tasks at the back of
+// its own deque and steals from the front of the others'; tasks submitted from
+// outside the pool go to a shared injection queue. Waiting on a TaskGroup runs
+// queued tasks instead of blocking, so tasks may fork and wait on subtasks.
+//
+// parallelFor allocates nothing: its chunks are queued as a function pointer
+// and the caller's body rather than as std::functions, and the deques are
+// ring buffers that only ever grow.
+class ThreadPool {
+public:
+    class TaskGroup {
+    public:
+        TaskGroup(): pending(0) {}
+        
+    private:
+        friend class ThreadPool;
+        std::atomic<int> pending;
+    };
+    
+    // threadCount 0 uses one worker per hardware thread, less the caller's.
+    ThreadPool(int threadCount = 0);
+    ~ThreadPool();
+    
+    int workerCount() const {
+        return (int)threads.size();
+    }
+    
+    void run(TaskGroup &group, std::function<void()> task);
+    void wait(TaskGroup &group);
+    
+    // Calls body(begin, end) over [begin, end) in chunks of at least grainSize.
+    template <typename Body>
+    void parallelFor(int begin, int end, int grainSize, const Body &body) {
+        parallelForRange(begin, end, grainSize, &callRange<Body>, &body);
+    }
+    
+private:
+    typedef void (*RangeFunction)(const void *body, int begin, int end);
+    
+    // A run() task, or a parallelFor chunk when range is set.
+    struct Task {
+        std::function<void()> function;
+        RangeFunction range = nullptr;
+        const void *body = nullptr;
+        int begin = 0;
+        int end = 0;
+        TaskGroup *group = nullptr;
+    };
+    
+    // A deque of tasks in a ring buffer, grown only when full.
+    struct Queue {
+        std::mutex mutex;
+        std::vector<Task> tasks;
+        size_t first;
+        size_t count;
+        
+        Queue();
+        void pushBack(Task &&task);
+        Task popBack();
+        Task popFront();
+    };
+    
+    // queues[i] belongs to worker i; the last one is the injection queue.
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<int> queued;
+    std::atomic<bool> stopping;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    
+    template <typename Body>
+    static void callRange(const void *body, int begin, int end) {
+        (*static_cast<const Body *>(body))(begin, end);
+    }
+    
+    void parallelForRange(int begin, int end, int grainSize, RangeFunction range, const void *body);
+    void push(Task &&task);
+    int queueIndex() const;
+    bool runOne(int home);
+    void workerLoop(int index);
+};
+
+#endif /* ThreadPool_hpp */
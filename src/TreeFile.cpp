@@ -0,0 +1,242 @@
+//
+//  TreeFile.cpp
+//  CircleTree
+//
+
+#include "TreeFile.hpp"
+#include "Trees.hpp"
+#include <string.h>
+#include <limits.h>
+#include <fstream>
+#include <typeinfo>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static void writeChannel(const AnimatorChannel &channel, float *out) {
+    out[0] = channel.valueGain;
+    out[1] = channel.bias;
+    out[2] = channel.amplitude;
+    out[3] = channel.timeFrequency;
+    out[4] = channel.valueFrequency;
+    out[5] = channel.phase;
+    out[6] = channel.sqrtTime ? 1 : 0;
+}
+
+static AnimatorChannel readChannel(const float *in) {
+    AnimatorChannel channel;
+    channel.valueGain = in[0];
+    channel.bias = in[1];
+    channel.amplitude = in[2];
+    channel.timeFrequency = in[3];
+    channel.valueFrequency = in[4];
+    channel.phase = in[5];
+    channel.sqrtTime = in[6] != 0;
+    return channel;
+}
+
+bool Tree::save(const std::string &path) const {
+    int count = nodes.count();
+    int capacity = TreeNodes::paddedCapacity(count);
+    size_t blockBytes = (size_t)capacity * sizeof(float) * TreeNodes::fieldCount;
+    
+    TreeFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, treeFileMagic, sizeof(header.magic));
+    header.version = TreeFileHeader::currentVersion;
+    header.byteOrder = TreeFileHeader::nativeByteOrder;
+    header.nodeCount = count;
+    header.capacity = capacity;
+    header.fieldCount = TreeNodes::fieldCount;
+    header.animatorCount = (uint32_t)animators.size();
+    header.nodesOffset = sizeof(TreeFileHeader);
+    header.animatorsOffset = header.nodesOffset + blockBytes;
+    header.size = size;
+    header.revision = nodes.revision();
+    
+    std::vector<char> block(blockBytes);
+    nodes.copyBlock(block.data());
+    
+    std::vector<TreeFileAnimator> records(animators.size());
+    for (size_t i = 0; i < animators.size(); i++) {
+        TreeFileAnimator &record = records[i];
+        memset(&record, 0, sizeof(record));
+        const NodeAnimator *animator = animators[i];
+        // Subclasses may ignore the channels they inherit.
+        if (!animator->hasChannels || typeid(*animator) != typeid(NodeAnimator)) {
+            record.kind = TreeFileAnimator::opaqueAnimator;
+            continue;
+        }
+        record.kind = TreeFileAnimator::channelAnimator;
+        const NodeAnimatorChannels &channels = animator->channels;
+        writeChannel(channels.aspect, record.channels[0]);
+        writeChannel(channels.branchAngle, record.channels[1]);
+        writeChannel(channels.terminusAngle, record.channels[2]);
+        writeChannel(channels.size, record.channels[3]);
+        writeChannel(channels.offset, record.channels[4]);
+    }
+    
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write((const char *)&header, sizeof(header));
+    file.write(block.data(), block.size());
+    file.write((const char *)records.data(), records.size() * sizeof(TreeFileAnimator));
+    if (!file) {
+        ofLogError("TreeFile") << "couldn't write " << path;
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<char> mapFile(const std::string &path, size_t &length) {
+#ifdef _WIN32
+    // No mmap: read the whole file into one block instead.
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        ofLogError("TreeFile") << "couldn't open " << path;
+        return std::shared_ptr<char>();
+    }
+    length = (size_t)file.tellg();
+    std::shared_ptr<char> mapping((char *)::operator new(length, std::align_val_t(64)), [](char *memory) {
+        ::operator delete(memory, std::align_val_t(64));
+    });
+    file.seekg(0);
+    file.read(mapping.get(), length);
+    if (!file) {
+        ofLogError("TreeFile") << "couldn't read " << path;
+        return std::shared_ptr<char>();
+    }
+#else
+    int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        ofLogError("TreeFile") << "couldn't open " << path;
+        return std::shared_ptr<char>();
+    }
+    struct stat status;
+    length = fstat(descriptor, &status) == 0 ? (size_t)status.st_size : 0;
+    // Private and writable: pages are copied as they are written, and the
+    // file itself is never modified.
+    void *memory = length > 0 ? mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0) : MAP_FAILED;
+    close(descriptor);
+    if (memory == MAP_FAILED) {
+        ofLogError("TreeFile") << "couldn't map " << path;
+        return std::shared_ptr<char>();
+    }
+    std::shared_ptr<char> mapping((char *)memory, [length](char *memory) {
+        munmap(memory, length);
+    });
+#endif
+    return mapping;
+}
+
+// Whether every node's links and cached structure are what add() and
+// updateStructure() would have made: the root has no parent, every other
+// node's parent comes before it, children come after their parent and link
+// back to it, and depth, height, leafCount and subtreeSize agree with the
+// children. The renderer and visitors index with all of these without
+// checking. Each node's children are read once, so this is one pass.
+static bool hasValidStructure(const TreeNodes &nodes) {
+    int count = nodes.count();
+    for (int node = 0; node < count; node++) {
+        int parent = nodes.parent[node];
+        if (node == Tree::root ? parent >= 0 || nodes.depth[node] != 0 : parent < 0 || parent >= node) {
+            return false;
+        }
+        int childCount = nodes.childCount[node];
+        int firstChild = nodes.firstChild[node];
+        if (childCount < 0 || (childCount > 0 && (firstChild <= node || (int64_t)firstChild + childCount > count))) {
+            return false;
+        }
+        int64_t height = 0;
+        int64_t leafCount = childCount == 0 ? 1 : 0;
+        int64_t subtreeSize = 1;
+        for (int child = firstChild; child < firstChild + childCount; child++) {
+            if (nodes.parent[child] != node || nodes.depth[child] != nodes.depth[node] + 1) {
+                return false;
+            }
+            height = max(height, (int64_t)nodes.height[child] + 1);
+            leafCount += nodes.leafCount[child];
+            subtreeSize += nodes.subtreeSize[child];
+        }
+        if (nodes.height[node] != height || nodes.height[node] < 0 || nodes.height[node] >= count ||
+            nodes.leafCount[node] != leafCount || nodes.subtreeSize[node] != subtreeSize) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Tree *Tree::load(const std::string &path) {
+    size_t length = 0;
+    std::shared_ptr<char> mapping = mapFile(path, length);
+    if (mapping == nullptr) {
+        return nullptr;
+    }
+    
+    TreeFileHeader header;
+    if (length < sizeof(header)) {
+        ofLogError("TreeFile") << path << " is too short for a tree file";
+        return nullptr;
+    }
+    memcpy(&header, mapping.get(), sizeof(header));
+    if (memcmp(header.magic, treeFileMagic, sizeof(header.magic)) != 0) {
+        ofLogError("TreeFile") << path << " isn't a tree file";
+        return nullptr;
+    }
+    if (header.byteOrder != TreeFileHeader::nativeByteOrder) {
+        ofLogError("TreeFile") << path << " was written with another byte order";
+        return nullptr;
+    }
+    if (header.version != TreeFileHeader::currentVersion) {
+        ofLogError("TreeFile") << path << " is version " << header.version << "; this build reads version " << TreeFileHeader::currentVersion;
+        return nullptr;
+    }
+    size_t blockBytes = (size_t)header.capacity * sizeof(float) * TreeNodes::fieldCount;
+    size_t animatorBytes = (size_t)header.animatorCount * sizeof(TreeFileAnimator);
+    if (header.fieldCount != TreeNodes::fieldCount ||
+        header.capacity % 16 != 0 || header.nodeCount > header.capacity ||
+        header.capacity > INT_MAX ||
+        // Compared by subtraction, since offset + bytes can wrap.
+        header.nodesOffset % 64 != 0 || header.nodesOffset > length || blockBytes > length - header.nodesOffset ||
+        header.animatorsOffset > length || animatorBytes > length - header.animatorsOffset ||
+        header.revision >= INT_MAX / 2) {
+        ofLogError("TreeFile") << path << " is truncated or its layout doesn't match this build";
+        return nullptr;
+    }
+    
+    Tree *tree = new Tree(header.size);
+    tree->nodes.adopt(mapping.get() + header.nodesOffset, header.nodeCount, header.capacity, header.revision, mapping);
+    if (!hasValidStructure(tree->nodes)) {
+        ofLogError("TreeFile") << path << " has nodes whose links or structure don't add up";
+        delete tree;
+        return nullptr;
+    }
+    
+    std::vector<NodeAnimator *> animators;
+    const TreeFileAnimator *records = (const TreeFileAnimator *)(mapping.get() + header.animatorsOffset);
+    bool opaque = false;
+    for (uint32_t i = 0; i < header.animatorCount; i++) {
+        TreeFileAnimator record;
+        memcpy(&record, records + i, sizeof(record));
+        if (record.kind != TreeFileAnimator::channelAnimator) {
+            opaque = true;
+            animators.push_back(new NodeAnimator(NodeAnimatorChannels()));
+            continue;
+        }
+        animators.push_back(new NodeAnimator(NodeAnimatorChannels(readChannel(record.channels[0]),
+                                                                  readChannel(record.channels[1]),
+                                                                  readChannel(record.channels[2]),
+                                                                  readChannel(record.channels[3]),
+                                                                  readChannel(record.channels[4]))));
+    }
+    if (opaque) {
+        ofLogWarning("TreeFile") << path << " has animators that can't be stored; they load static";
+    }
+    tree->setAnimators(animators);
+    tree->animatorGeneration++;
+    return tree;
+}
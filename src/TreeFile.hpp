@@ -0,0 +1,70 @@
+//
+//  TreeFile.hpp
+//  CircleTree
+//
+
+#ifndef TreeFile_hpp
+#define TreeFile_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+
+// The on-disk tree snapshot written by Tree::save and mapped by Tree::load.
+// Everything is in the writer's byte order, which byteOrder records:
+//
+//     TreeFileHeader                       64 bytes
+//     node block                           at nodesOffset, 64-byte aligned
+//     TreeFileAnimator[animatorCount]      at animatorsOffset
+//
+// The node block is exactly TreeNodes' own block: fieldCount arrays of
+// capacity 4-byte elements each, so a mapping is used as node storage
+// without touching individual nodes; revision is the writer's TreeNodes
+// revision, which every change stamp in the block is at most. Loading
+// checks the header and that each node's links and cached depth, height,
+// leafCount and subtreeSize are consistent; the per-node parameters are
+// trusted. Bump version whenever any of this changes.
+struct TreeFileHeader {
+    static constexpr uint32_t currentVersion = 3;
+    static constexpr uint32_t nativeByteOrder = 0x01020304;
+    
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t nodeCount;
+    uint32_t capacity;
+    uint32_t fieldCount;
+    uint32_t animatorCount;
+    uint64_t nodesOffset;
+    uint64_t animatorsOffset;
+    float size;
+    uint32_t revision;
+    uint32_t reserved[2];
+};
+
+static_assert(sizeof(TreeFileHeader) == 64, "TreeFileHeader is 64 bytes");
+
+static const char treeFileMagic[8] = { 'C', 'T', 'R', 'E', 'E', '\r', '\n', 0x1a };
+
+// One NodeAnimator, by index. Channel animators store their five
+// AnimatorChannels as (valueGain, bias, amplitude, timeFrequency,
+// valueFrequency, phase, sqrtTime) in BranchParameters order; anything
+// else (function pointers, compiled animators) can't be stored and is
+// marked opaque.
+struct TreeFileAnimator {
+    enum Kind: uint32_t {
+        opaqueAnimator = 0,
+        channelAnimator = 1
+    };
+    
+    uint32_t kind;
+    float channels[5][7];
+};
+
+// Maps path privately, so the caller may write to the pages without changing
+// the file, and sets length to its size. The mapping goes away with the last
+// copy of the pointer. Logs and returns nullptr on failure.
+std::shared_ptr<char> mapFile(const std::string &path, size_t &length);
+
+#endif /* TreeFile_hpp */
@@ -0,0 +1,94 @@
+//
+//  TreePipeline.cpp
+//  CircleTree
+//
+
+#include "TreePipeline.hpp"
+
+TreePipeline::TreePipeline(TreeAnimator *animator, TreeRenderer *renderer):
+animator(animator),
+renderer(renderer),
+profiler(nullptr),
+animatePhase(-1),
+renderPhase(-1),
+ready(0),
+front(1),
+behind(2),
+back(3),
+requestedTime(0),
+requested(0),
+completed(0),
+stopping(false)
+{
+    worker = std::thread(&TreePipeline::run, this);
+}
+
+TreePipeline::~TreePipeline() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+void TreePipeline::submit(float time) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        requestedTime = time;
+        requested++;
+    }
+    wake.notify_one();
+}
+
+void TreePipeline::waitIdle() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this]() { return completed == requested; });
+}
+
+void TreePipeline::setProfiler(FrameProfiler *profiler) {
+    this->profiler = profiler;
+    animatePhase = profiler->addPhase("animate");
+    renderPhase = profiler->addPhase("transforms");
+}
+
+const RenderedTree &TreePipeline::acquire() {
+    if (ready.load() & freshBit) {
+        int taken = ready.exchange(behind) & indexMask;
+        behind = front;
+        front = taken;
+    }
+    return buffers[front];
+}
+
+void TreePipeline::run() {
+    while (true) {
+        float time;
+        uint64_t frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]() { return requested != completed || stopping; });
+            if (stopping) {
+                return;
+            }
+            time = requestedTime;
+            frame = requested;
+        }
+        
+        {
+            FrameProfiler::Scope scope(profiler, animatePhase);
+            animator->animate(time);
+        }
+        {
+            FrameProfiler::Scope scope(profiler, renderPhase);
+            renderer->render(buffers[back]);
+        }
+        back = ready.exchange(back | freshBit) & indexMask;
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            completed = frame;
+        }
+        idle.notify_all();
+    }
+}
@@ -0,0 +1,80 @@
+//
+//  TreePipeline.hpp
+//  CircleTree
+//
+
+#ifndef TreePipeline_hpp
+#define TreePipeline_hpp
+
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "Trees.hpp"
+#include "FrameProfiler.hpp"
+
+// Runs animation and the world-transform pass on a worker thread, so the
+// next frame is simulated while the GL thread draws the current one.
+//
+// Snapshots are quadruple buffered: the worker renders into its back buffer
+// and publishes it by swapping it with the ready slot; the GL thread takes
+// the ready slot in exchange for its previous buffer, and its front buffer
+// becomes the previous one. Both swaps are a single atomic exchange, and
+// neither side ever touches the other's buffers. Keeping the previous
+// snapshot lets the GL thread interpolate between the last two.
+class TreePipeline {
+public:
+    TreePipeline(TreeAnimator *animator, TreeRenderer *renderer);
+    ~TreePipeline();
+    
+    // Asks the worker to animate to time and render a snapshot of it.
+    void submit(float time);
+    // Blocks until every submitted frame has been published. The tree can
+    // be read or changed directly until the next submit.
+    void waitIdle();
+    // The newest published snapshot. It stays valid, and unchanged, until
+    // the next call.
+    const RenderedTree &acquire();
+    // What the last acquire() returned.
+    const RenderedTree &current() const {
+        return buffers[front];
+    }
+    // The snapshot acquire() returned before that, valid just as long.
+    // Empty until two have been acquired.
+    const RenderedTree &previous() const {
+        return buffers[behind];
+    }
+    // Times the worker's animation and transform passes as profiler phases.
+    // Call before the first submit.
+    void setProfiler(FrameProfiler *profiler);
+    
+private:
+    static const int freshBit = 4;
+    static const int indexMask = 3;
+    
+    TreeAnimator *animator;
+    TreeRenderer *renderer;
+    FrameProfiler *profiler;
+    int animatePhase;
+    int renderPhase;
+    RenderedTree buffers[4];
+    // Buffer index of the latest snapshot, plus freshBit until it's acquired.
+    std::atomic<int> ready;
+    int front;
+    int behind;
+    int back;
+    
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    float requestedTime;
+    uint64_t requested;
+    uint64_t completed;
+    bool stopping;
+    
+    void run();
+};
+
+#endif /* TreePipeline_hpp */
@@ -7,6 +7,11 @@
 
 #include "Trees.hpp"
 #include <vector>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <new>
+#include <algorithm>
 
 float animConstant(float v, float d) { return v; }
 
@@ -62,41 +67,617 @@ offset(offset)
     }
 }
 
-NodeAnimator::NodeAnimator(NodeAnimatorFunctions speed) {
+NodeAnimatorChannels::NodeAnimatorChannels() {
+}
+
+NodeAnimatorChannels::NodeAnimatorChannels(AnimatorChannel aspect,
+                                           AnimatorChannel branchAngle,
+                                           AnimatorChannel terminusAngle,
+                                           AnimatorChannel size,
+                                           AnimatorChannel offset) :
+aspect(aspect),
+branchAngle(branchAngle),
+terminusAngle(terminusAngle),
+size(size),
+offset(offset)
+{}
+
+NodeAnimator::NodeAnimator(NodeAnimatorFunctions speed):
+hasChannels(false)
+{
     f_speed = speed;
 }
 
-void NodeAnimator::applyTo(TreeNode *node, float dt) {
-    BranchParameters speed = node->parameters;
+NodeAnimator::NodeAnimator(NodeAnimatorChannels channels):
+hasChannels(true),
+channels(channels)
+{
+}
+
+static void applyChannel(const AnimatorChannel &channel, float *field, const int *group, int count, float *scratch, float dt) {
+    if (channel.isConstant()) {
+        return;
+    }
+    if (channel.isTimeOnly()) {
+        float value = channel.evaluate(0, dt);
+        for (int i = 0; i < count; i++) {
+            field[group[i]] = value;
+        }
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        scratch[i] = field[group[i]];
+    }
+    animateChannel(channel, scratch, count, dt);
+    for (int i = 0; i < count; i++) {
+        field[group[i]] = scratch[i];
+    }
+}
+
+static void applyFunction(AnimatorFunction function, float *field, const int *group, int count, float dt) {
+    if (function == &animConstant) {
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        field[group[i]] = function(field[group[i]], dt);
+    }
+}
+
+void NodeAnimator::applyTo(TreeNodes &nodes, const int *group, int count, float *scratch, float dt) {
+    if (!hasChannels) {
+        applyFunction(f_speed.aspect, nodes.aspect, group, count, dt);
+        applyFunction(f_speed.branchAngle, nodes.branchAngle, group, count, dt);
+        applyFunction(f_speed.terminusAngle, nodes.terminusAngle, group, count, dt);
+        applyFunction(f_speed.size, nodes.size, group, count, dt);
+        applyFunction(f_speed.offset, nodes.offset, group, count, dt);
+        return;
+    }
+    applyChannel(channels.aspect, nodes.aspect, group, count, scratch, dt);
+    applyChannel(channels.branchAngle, nodes.branchAngle, group, count, scratch, dt);
+    applyChannel(channels.terminusAngle, nodes.terminusAngle, group, count, scratch, dt);
+    applyChannel(channels.size, nodes.size, group, count, scratch, dt);
+    applyChannel(channels.offset, nodes.offset, group, count, scratch, dt);
+}
+
+void NodeAnimator::applyTo(float *const *fields, int count, float dt) {
+    if (!hasChannels) {
+        AnimatorFunction functions[] = { f_speed.aspect, f_speed.branchAngle, f_speed.terminusAngle, f_speed.size, f_speed.offset };
+        for (int field = 0; field < 5; field++) {
+            if (functions[field] == &animConstant) {
+                continue;
+            }
+            for (int i = 0; i < count; i++) {
+                fields[field][i] = functions[field](fields[field][i], dt);
+            }
+        }
+        return;
+    }
+    const AnimatorChannel *fieldChannels[] = { &channels.aspect, &channels.branchAngle, &channels.terminusAngle, &channels.size, &channels.offset };
+    for (int field = 0; field < 5; field++) {
+        const AnimatorChannel &channel = *fieldChannels[field];
+        if (channel.isConstant()) {
+            continue;
+        }
+        if (channel.isTimeOnly()) {
+            std::fill(fields[field], fields[field] + count, channel.evaluate(0, dt));
+            continue;
+        }
+        animateChannel(channel, fields[field], count, dt);
+    }
+}
+
+bool NodeAnimator::isStatic() const {
+    if (hasChannels) {
+        return channels.aspect.isConstant() &&
+               channels.branchAngle.isConstant() &&
+               channels.terminusAngle.isConstant() &&
+               channels.size.isConstant() &&
+               channels.offset.isConstant();
+    }
+    return f_speed.aspect == &animConstant &&
+           f_speed.branchAngle == &animConstant &&
+           f_speed.terminusAngle == &animConstant &&
+           f_speed.size == &animConstant &&
+           f_speed.offset == &animConstant;
+}
+
+void NodeAnimator::applyTo(TreeNodes &nodes, int node, float dt) {
+    if (hasChannels) {
+        nodes.aspect[node] = channels.aspect.evaluate(nodes.aspect[node], dt);
+        nodes.branchAngle[node] = channels.branchAngle.evaluate(nodes.branchAngle[node], dt);
+        nodes.terminusAngle[node] = channels.terminusAngle.evaluate(nodes.terminusAngle[node], dt);
+        nodes.size[node] = channels.size.evaluate(nodes.size[node], dt);
+        nodes.offset[node] = channels.offset.evaluate(nodes.offset[node], dt);
+        return;
+    }
+    nodes.aspect[node] = f_speed.aspect(nodes.aspect[node], dt);
+    nodes.branchAngle[node] = f_speed.branchAngle(nodes.branchAngle[node], dt);
+    nodes.terminusAngle[node] = f_speed.terminusAngle(nodes.terminusAngle[node], dt);
+    nodes.size[node] = f_speed.size(nodes.size[node], dt);
+    nodes.offset[node] = f_speed.offset(nodes.offset[node], dt);
+}
+
+TreeNodes::TreeNodes():
+block(nullptr),
+nodeCount(0),
+capacity(0),
+currentRevision(0)
+{
+    bind(nullptr, 0);
+}
+
+TreeNodes::TreeNodes(const TreeNodes &other): TreeNodes() {
+    *this = other;
+}
+
+TreeNodes &TreeNodes::operator=(const TreeNodes &other) {
+    if (this == &other) {
+        return *this;
+    }
+    clear();
+    reserve(other.nodeCount);
+    void *source[fieldCount];
+    void *destination[fieldCount];
+    other.fields(source);
+    fields(destination);
+    for (int i = 0; i < fieldCount; i++) {
+        memcpy(destination[i], source[i], other.nodeCount * sizeof(float));
+    }
+    nodeCount = other.nodeCount;
+    // Snapshots of either side's old contents must not look current.
+    currentRevision = max(currentRevision, other.currentRevision) + 1;
+    for (int node = 0; node < nodeCount; node++) {
+        touch(node);
+    }
+    return *this;
+}
+
+TreeNodes::~TreeNodes() {
+    release();
+}
+
+void TreeNodes::release() {
+    if (holder != nullptr) {
+        holder.reset();
+    } else if (block != nullptr) {
+        ::operator delete(block, std::align_val_t(alignment));
+    }
+    block = nullptr;
+}
+
+int TreeNodes::paddedCapacity(int count) {
+    return (count + 15) / 16 * 16;
+}
+
+void TreeNodes::copyBlock(void *destination) const {
+    int stride = paddedCapacity(nodeCount);
+    void *source[fieldCount];
+    fields(source);
+    memset(destination, 0, (size_t)stride * sizeof(float) * fieldCount);
+    for (int i = 0; i < fieldCount; i++) {
+        if (nodeCount > 0) {
+            memcpy((char *)destination + (size_t)stride * sizeof(float) * i, source[i], nodeCount * sizeof(float));
+        }
+    }
+}
+
+void TreeNodes::adopt(void *block, int count, int capacity, int revision, std::shared_ptr<void> holder) {
+    release();
+    bind(block, capacity);
+    this->holder = holder;
+    nodeCount = count;
+    // Past every stamp in the block, so its nodes read as unchanged to
+    // anything rendered from here on, and later writes as newer.
+    currentRevision = max(currentRevision, revision) + 1;
+}
+
+void TreeNodes::fields(void **out) const {
+    void *all[fieldCount] = { aspect, branchAngle, terminusAngle, size, offset, parent, firstChild, childCount, depth, height, leafCount, subtreeSize, animator, changed };
+    memcpy(out, all, sizeof(all));
+}
+
+void TreeNodes::bind(void *block, int capacity) {
+    static_assert(sizeof(float) == sizeof(int), "TreeNodes fields share one stride");
+    this->block = block;
+    this->capacity = capacity;
+    char *field = (char *)block;
+    size_t stride = capacity * sizeof(float);
+    aspect = (float *)(field);
+    branchAngle = (float *)(field + stride);
+    terminusAngle = (float *)(field + stride * 2);
+    size = (float *)(field + stride * 3);
+    offset = (float *)(field + stride * 4);
+    parent = (int *)(field + stride * 5);
+    firstChild = (int *)(field + stride * 6);
+    childCount = (int *)(field + stride * 7);
+    depth = (int *)(field + stride * 8);
+    height = (int *)(field + stride * 9);
+    leafCount = (int *)(field + stride * 10);
+    subtreeSize = (int *)(field + stride * 11);
+    animator = (int *)(field + stride * 12);
+    changed = (int *)(field + stride * 13);
+}
+
+void TreeNodes::reserve(int count) {
+    if (count <= capacity) {
+        return;
+    }
+    // A multiple of 16 keeps every field 64-byte aligned.
+    int newCapacity = paddedCapacity(count);
+    void *newBlock = ::operator new(newCapacity * sizeof(float) * fieldCount, std::align_val_t(alignment));
+    
+    void *oldFields[fieldCount];
+    void *newFields[fieldCount];
+    void *oldBlock = block;
+    std::shared_ptr<void> oldHolder = std::move(holder);
+    holder.reset();
+    fields(oldFields);
+    bind(newBlock, newCapacity);
+    fields(newFields);
+    if (oldBlock != nullptr) {
+        for (int i = 0; i < fieldCount; i++) {
+            memcpy(newFields[i], oldFields[i], nodeCount * sizeof(float));
+        }
+        // An adopted block goes with oldHolder.
+        if (oldHolder == nullptr) {
+            ::operator delete(oldBlock, std::align_val_t(alignment));
+        }
+    }
+}
+
+void TreeNodes::clear() {
+    nodeCount = 0;
+}
+
+int TreeNodes::add(BranchParameters parameters, int parent, bool updateAncestors) {
+    if (nodeCount == capacity) {
+        reserve(max(capacity * 2, 16));
+    }
+    int node = nodeCount++;
+    
+    aspect[node] = parameters.aspect;
+    branchAngle[node] = parameters.branchAngle;
+    terminusAngle[node] = parameters.terminusAngle;
+    size[node] = parameters.size;
+    offset[node] = parameters.offset;
+    
+    this->parent[node] = parent;
+    firstChild[node] = -1;
+    childCount[node] = 0;
+    depth[node] = parent < 0 ? 0 : depth[parent] + 1;
+    height[node] = 0;
+    leafCount[node] = 1;
+    subtreeSize[node] = 1;
+    animator[node] = -1;
+    touch(node);
     
-    speed.aspect = f_speed.aspect(speed.aspect, dt);
-    speed.branchAngle = f_speed.branchAngle(speed.branchAngle, dt);
-    speed.terminusAngle = f_speed.terminusAngle(speed.terminusAngle, dt);
-    speed.size = f_speed.size(speed.size, dt);
-    speed.offset = f_speed.offset(speed.offset, dt);
+    if (parent < 0) {
+        return node;
+    }
+    // A leaf parent trades its own leaf for the new one.
+    int newLeaves = childCount[parent] == 0 ? 0 : 1;
+    if (childCount[parent] == 0) {
+        firstChild[parent] = node;
+    }
+    childCount[parent]++;
+    if (updateAncestors) {
+        int distance = 1;
+        for (int ancestor = parent; ancestor >= 0; ancestor = this->parent[ancestor], distance++) {
+            height[ancestor] = max(height[ancestor], distance);
+            leafCount[ancestor] += newLeaves;
+            subtreeSize[ancestor]++;
+        }
+    }
     
-    node->parameters.aspect = speed.aspect;
-    node->parameters.branchAngle = speed.branchAngle;
-    node->parameters.terminusAngle = speed.terminusAngle;
-    node->parameters.size = speed.size;
-    node->parameters.offset = speed.offset;
+    return node;
 }
 
-TreeNode::TreeNode(BranchParameters parameters):
-parameters(parameters),
-animator(nullptr),
-children(std::vector<TreeNode*>())
-{
+void TreeNodes::updateStructure() {
+    for (int node = 0; node < nodeCount; node++) {
+        height[node] = 0;
+        leafCount[node] = childCount[node] == 0 ? 1 : 0;
+        subtreeSize[node] = 1;
+    }
+    // Children follow their parents, so a backward sweep finishes every
+    // subtree before its root.
+    for (int node = nodeCount - 1; node >= 0; node--) {
+        int parent = this->parent[node];
+        if (parent >= 0) {
+            height[parent] = max(height[parent], height[node] + 1);
+            leafCount[parent] += leafCount[node];
+            subtreeSize[parent] += subtreeSize[node];
+        }
+    }
+}
+
+BranchParameters TreeNodes::parameters(int node) const {
+    return BranchParameters(aspect[node], branchAngle[node], terminusAngle[node], size[node], offset[node]);
+}
+
+void TreeNodes::setParameters(int node, BranchParameters parameters) {
+    aspect[node] = parameters.aspect;
+    branchAngle[node] = parameters.branchAngle;
+    terminusAngle[node] = parameters.terminusAngle;
+    size[node] = parameters.size;
+    offset[node] = parameters.offset;
+    touch(node);
 }
 
 Tree::Tree(float size):
-root(new TreeNode(BranchParameters())),
-size(100)
+animatorGeneration(0),
+size(size)
 {
 }
 
-Tree::Tree(float size, TreeNode *root):
-root(root),
-size(size)
+Tree::~Tree() {
+    for (NodeAnimator *animator: animators) {
+        delete animator;
+    }
+}
+
+void Tree::setAnimators(const std::vector<NodeAnimator *> &animators) {
+    for (NodeAnimator *animator: this->animators) {
+        if (std::find(animators.begin(), animators.end(), animator) == animators.end()) {
+            delete animator;
+        }
+    }
+    this->animators = animators;
+}
+
+int LevelOfDetail::segments(float radius, int maxSegments) const {
+    if (!enabled) {
+        return maxSegments;
+    }
+    // A chord over 2 * pi / n of the circle misses the arc by about
+    // r * (pi / n)^2 / 2.
+    float pixels = radius * pixelsPerUnit;
+    float needed = PI * sqrtf(pixels / (2 * maxPixelError));
+    int segments = 8;
+    while (segments < needed && segments < maxSegments) {
+        segments *= 2;
+    }
+    return min(segments, maxSegments);
+}
+
+void ViewportCulling::setTransform(float x, float y, float scale, float width, float height) {
+    viewport = ofRectangle(-x / scale, -y / scale, width / scale, height / scale);
+}
+
+BoundingCircle BoundingCircle::merged(const BoundingCircle &other) const {
+    if (other.radius < 0) {
+        return *this;
+    }
+    if (radius < 0) {
+        return other;
+    }
+    float dx = other.x - x;
+    float dy = other.y - y;
+    float distance = sqrtf(dx * dx + dy * dy);
+    if (distance + other.radius <= radius) {
+        return *this;
+    }
+    if (distance + radius <= other.radius) {
+        return other;
+    }
+    float mergedRadius = (distance + radius + other.radius) / 2;
+    float t = (mergedRadius - radius) / distance;
+    return BoundingCircle(x + dx * t, y + dy * t, mergedRadius);
+}
+
+void RenderedTree::interpolate(const RenderedTree &from, const RenderedTree &to, float alpha, ThreadPool *pool, int grainSize) {
+    if (from.count() != to.count() || from.size != to.size) {
+        *this = to;
+        return;
+    }
+    // Parents, depths and colors only change with the topology.
+    if (count() != to.count()) {
+        nodes = to.nodes;
+    }
+    size = to.size;
+    rootScale = from.rootScale + (to.rootScale - from.rootScale) * alpha;
+    revision = to.revision;
+    bool hasBounds = from.bounds.size() == from.nodes.size() && to.bounds.size() == to.nodes.size();
+    bounds.resize(hasBounds ? to.bounds.size() : 0);
+    
+    auto range = [&](int begin, int end) {
+        for (int node = begin; node < end; node++) {
+            const RenderedTreeNode &a = from.nodes[node];
+            const RenderedTreeNode &b = to.nodes[node];
+            RenderedTreeNode &blended = nodes[node];
+            blended.position.x = a.position.x + (b.position.x - a.position.x) * alpha;
+            blended.position.y = a.position.y + (b.position.y - a.position.y) * alpha;
+            blended.scale = a.scale + (b.scale - a.scale) * alpha;
+            blended.angle = a.angle + (b.angle - a.angle) * alpha;
+            if (hasBounds) {
+                bounds[node] = from.bounds[node].merged(to.bounds[node]);
+            }
+        }
+    };
+    if (pool == nullptr) {
+        range(0, count());
+    } else {
+        pool->parallelFor(0, count(), grainSize, range);
+    }
+}
+
+bool BoundingCircle::intersects(const ofRectangle &rectangle) const {
+    if (radius < 0) {
+        return false;
+    }
+    float nearestX = ofClamp(x, rectangle.x, rectangle.x + rectangle.width);
+    float nearestY = ofClamp(y, rectangle.y, rectangle.y + rectangle.height);
+    float dx = x - nearestX;
+    float dy = y - nearestY;
+    return dx * dx + dy * dy <= radius * radius;
+}
+
+const std::vector<ofColor> &defaultTreePalette() {
+    static const std::vector<ofColor> palette = {
+        ofColor::fromHsb(150, 240, 230, 200),
+        ofColor::fromHsb(30, 255, 250, 240),
+        ofColor(255, 0, 0, 145),
+        ofColor(255, 200, 200, 100)
+    };
+    return palette;
+}
+
+ofColor treePaletteColor(const std::vector<ofColor> &palette, int height) {
+    if (palette.empty()) {
+        return ofColor(255, 255, 255, 255);
+    }
+    return palette[max(0, min(height, (int)palette.size() - 1))];
+}
+
+void collectVisibleNodes(const Tree *tree, const RenderedTree &renderedTree, const LevelOfDetail &lod, const ViewportCulling &culling, std::vector<int> &visible, NodeRanges &frontier, NodeRanges &next) {
+    const TreeNodes &nodes = tree->nodes;
+    float radius = renderedTree.size / 2;
+    visible.clear();
+    if (renderedTree.count() == 0) {
+        return;
+    }
+    
+    // Each level's frontier is a list of sibling ranges. Parents are visited
+    // in index order and their children are stored in the same order, so the
+    // output comes out sorted.
+    frontier.clear();
+    frontier.push_back({ Tree::root, 1 });
+    int levels = 0;
+    while (!frontier.empty()) {
+        levels++;
+        next.clear();
+        for (const std::pair<int, int> &range: frontier) {
+            for (int node = range.first; node < range.first + range.second; node++) {
+                if (!lod.isVisible(radius * renderedTree.nodes[node].scale) || !culling.isVisible(renderedTree, node)) {
+                    continue;
+                }
+                visible.push_back(node);
+                if (nodes.childCount[node] > 0) {
+                    next.push_back({ nodes.firstChild[node], nodes.childCount[node] });
+                }
+            }
+        }
+        frontier.swap(next);
+    }
+    // Swapped back to where they started, each buffer holds the same levels
+    // every call, so neither grows once both have.
+    if (levels % 2 == 1) {
+        frontier.swap(next);
+    }
+}
+
+TreeRenderer::TreeRenderer(Tree *tree):
+tree(tree),
+palette(defaultTreePalette()),
+pool(nullptr),
+grainSize(8192),
+computeBounds(false),
+incremental(true),
+updatedNodes(0),
+boundsVisitor(tree)
 {
 }
+
+void TreeRenderer::render(RenderedTree &renderedTree) {
+    TreeNodes &nodes = tree->nodes;
+    int count = nodes.count();
+    
+    // A snapshot from before a resize or a size change is redone in full.
+    int since = incremental ? renderedTree.revision : -1;
+    if (renderedTree.count() != count) {
+        renderedTree.nodes.resize(count);
+        renderTopology(renderedTree);
+        since = -1;
+    }
+    if (renderedTree.size != tree->size) {
+        since = -1;
+    }
+    updatedNodes = 0;
+    if (count == 0) {
+        renderedTree.revision = nodes.revision();
+        nodes.advanceRevision();
+        return;
+    }
+    if (levelStarts.empty() || levelStarts.back() != count) {
+        levelStarts.clear();
+        for (int node = 0; node < count; node++) {
+            if (node == 0 || nodes.depth[node] != nodes.depth[node - 1]) {
+                levelStarts.push_back(node);
+            }
+        }
+        levelStarts.push_back(count);
+    }
+    
+    worldRevision.resize(count);
+    
+    RenderedTreeNode *rendered = renderedTree.nodes.data();
+    renderedTree.size = tree->size;
+    renderedTree.rootScale = nodes.size[Tree::root];
+    rendered[Tree::root].position = ofPoint(0, 0);
+    rendered[Tree::root].scale = 1;
+    rendered[Tree::root].angle = 0;
+    // The root's transform is fixed, but its size feeds rootScale.
+    worldRevision[Tree::root] = nodes.changed[Tree::root];
+    
+    if (pool == nullptr) {
+        updatedNodes = renderRange(renderedTree, Tree::root + 1, count, since);
+    } else {
+        std::atomic<int> updated(0);
+        for (int level = 1; level + 1 < (int)levelStarts.size(); level++) {
+            pool->parallelFor(levelStarts[level], levelStarts[level + 1], grainSize, [&](int begin, int end) {
+                updated.fetch_add(renderRange(renderedTree, begin, end, since), std::memory_order_relaxed);
+            });
+        }
+        updatedNodes = updated.load();
+    }
+    
+    if (!computeBounds) {
+        renderedTree.bounds.clear();
+    } else if (updatedNodes > 0 || worldRevision[Tree::root] > since || (int)renderedTree.bounds.size() != count) {
+        boundsVisitor.pool = pool;
+        boundsVisitor.visitAll(renderedTree);
+    }
+    
+    renderedTree.revision = nodes.revision();
+    nodes.advanceRevision();
+}
+
+int TreeRenderer::renderRange(RenderedTree &renderedTree, int begin, int end, int since) {
+    const TreeNodes &nodes = tree->nodes;
+    float radius = tree->size / 2;
+    RenderedTreeNode *rendered = renderedTree.nodes.data();
+    int *revisions = worldRevision.data();
+    int updated = 0;
+    
+    for (int node = begin; node < end; node++) {
+        int revision = max(nodes.changed[node], revisions[nodes.parent[node]]);
+        revisions[node] = revision;
+        if (revision <= since) {
+            continue;
+        }
+        updated++;
+        
+        const RenderedTreeNode &parent = rendered[nodes.parent[node]];
+        float terminus = parent.angle + nodes.terminusAngle[node];
+        float distance = parent.scale * (-radius - nodes.offset[node] * radius);
+        float radians = ofDegToRad(terminus);
+        
+        RenderedTreeNode &renderedNode = rendered[node];
+        renderedNode.position = ofPoint(parent.position.x - sinf(radians) * distance,
+                                        parent.position.y + cosf(radians) * distance);
+        renderedNode.scale = parent.scale * nodes.size[node];
+        renderedNode.angle = terminus + nodes.branchAngle[node];
+    }
+    return updated;
+}
+
+void TreeRenderer::renderTopology(RenderedTree &renderedTree) {
+    const TreeNodes &nodes = tree->nodes;
+    int count = nodes.count();
+    RenderedTreeNode *rendered = renderedTree.nodes.data();
+    
+    for (int node = 0; node < count; node++) {
+        rendered[node].parent = nodes.parent[node];
+        rendered[node].depth = nodes.depth[node];
+        rendered[node].color = treePaletteColor(palette, nodes.height[node]);
+    }
+}
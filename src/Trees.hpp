@@ -10,7 +10,13 @@
 
 #include <stdio.h>
 #include <vector>
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include "ofApp.h"
+#include "AnimatorKernels.hpp"
+#include "ThreadPool.hpp"
+#include "AnimationTrack.hpp"
 
 
 struct BranchParameters {
@@ -44,172 +50,590 @@ struct NodeAnimatorFunctions {
                           AnimatorFunction offset);
 };
 
-class TreeNode;
+// The closed-form counterpart of NodeAnimatorFunctions. Animators built from
+// channels are evaluated in SIMD batches by TreeAnimator.
+struct NodeAnimatorChannels {
+    AnimatorChannel aspect;
+    AnimatorChannel branchAngle;
+    AnimatorChannel terminusAngle;
+    AnimatorChannel size;
+    AnimatorChannel offset;
+    
+    NodeAnimatorChannels();
+    
+    NodeAnimatorChannels(AnimatorChannel aspect,
+                         AnimatorChannel branchAngle,
+                         AnimatorChannel terminusAngle,
+                         AnimatorChannel size,
+                         AnimatorChannel offset);
+};
+
+class NodeAnimator;
+
+// Node storage for a whole tree, one array per field. Nodes are laid out
+// breadth-first: every parent precedes its children, each node's children
+// occupy the contiguous range [firstChild, firstChild + childCount), and each
+// depth level is contiguous. Nodes must be added in that order.
+//
+// All the arrays live in one block, so a reserved tree costs one allocation
+// and one free however many nodes it has. Each array starts on a 64-byte
+// boundary.
+//
+// height, leafCount and subtreeSize describe each node's subtree: its
+// longest path down to a leaf, its leaves and its nodes, counting the node
+// itself. They are kept current as the tree grows, so they cost nothing to
+// read.
+//
+// Parameter changes are tracked with revisions: changed[node] is the
+// revision at which the node's parameters were last written. Whoever writes
+// a field directly calls touch(node); add and setParameters do it
+// themselves. Readers that keep derived data note revision() when they read
+// and call advanceRevision() afterwards, so later writes compare newer.
+struct TreeNodes {
+public:
+    float *aspect;
+    float *branchAngle;
+    float *terminusAngle;
+    float *size;
+    float *offset;
+    
+    int *parent;
+    int *firstChild;
+    int *childCount;
+    int *depth;
+    int *height;
+    int *leafCount;
+    int *subtreeSize;
+    int *animator;
+    int *changed;
+    
+    TreeNodes();
+    TreeNodes(const TreeNodes &other);
+    TreeNodes &operator=(const TreeNodes &other);
+    ~TreeNodes();
+    
+    int count() const {
+        return nodeCount;
+    }
+    
+    void reserve(int count);
+    // Keeps the block for reuse.
+    void clear();
+    
+    // Keeping the ancestors' height, leafCount and subtreeSize current walks
+    // up to the root. Bulk builders can pass false to skip the walk and call
+    // updateStructure once at the end instead.
+    int add(BranchParameters parameters, int parent, bool updateAncestors = true);
+    // Recomputes height, leafCount and subtreeSize in one backward sweep.
+    void updateStructure();
+    
+    // The block holds fieldCount arrays in declaration order, each capacity
+    // elements of 4 bytes, with capacity a multiple of 16.
+    static const int fieldCount = 14;
+    static int paddedCapacity(int count);
+    // Copies the nodes into a block of paddedCapacity(count()) elements per
+    // field, zero padded.
+    void copyBlock(void *destination) const;
+    // Uses an existing block in place, such as a mapped TreeFile, instead of
+    // copying it. holder keeps the block alive and is released along with
+    // it; the first add past capacity moves the nodes to a block of their
+    // own. No change stamp in the block may be newer than revision.
+    void adopt(void *block, int count, int capacity, int revision, std::shared_ptr<void> holder);
+    
+    BranchParameters parameters(int node) const;
+    void setParameters(int node, BranchParameters parameters);
+    
+    void touch(int node) {
+        changed[node] = currentRevision;
+    }
+    
+    int revision() const {
+        return currentRevision;
+    }
+    
+    void advanceRevision() {
+        currentRevision++;
+    }
+    
+private:
+    static const size_t alignment = 64;
+    
+    void *block;
+    // Set when the block isn't ours to delete.
+    std::shared_ptr<void> holder;
+    int nodeCount;
+    int capacity;
+    int currentRevision;
+    
+    void fields(void **out) const;
+    void bind(void *block, int capacity);
+    void release();
+};
 
 class NodeAnimator {
 public:
     NodeAnimatorFunctions f_speed;
+    // Set when the animator was built from channels, which then take the
+    // place of f_speed.
+    bool hasChannels;
+    NodeAnimatorChannels channels;
     
     NodeAnimator(NodeAnimatorFunctions speed);
-    
-    void applyTo(TreeNode *node, float dt);
-};
-
-class TreeNode {
-    public:
-    BranchParameters parameters;
-    std::vector<TreeNode *> children;
-    NodeAnimator *animator;
-    
-    TreeNode(BranchParameters parameters);
-    
-    int inverseDepth() {
-        int result = 0;
-        TreeNode *node = this;
-        while (!node->children.empty()) {
-            result++;
-            node = node->children[0];
-        }
-        return result;
-    }
+    NodeAnimator(NodeAnimatorChannels channels);
+    virtual ~NodeAnimator() {}
+    
+    virtual void applyTo(TreeNodes &nodes, int node, float dt);
+    // Animates every node in group. Channel animators gather each field into
+    // scratch (at least count floats), evaluate it there in one vector pass
+    // and scatter it back.
+    virtual void applyTo(TreeNodes &nodes, const int *group, int count, float *scratch, float dt);
+    // Animates count consecutive nodes kept outside a TreeNodes, as one array
+    // per BranchParameters field in declaration order. Channels run straight
+    // over the arrays, with no gather.
+    virtual void applyTo(float *const *fields, int count, float dt);
+    
+    // True when every channel leaves its value alone, so the nodes this
+    // animates never change.
+    virtual bool isStatic() const;
 };
 
+// Owns its nodes and its animators; deleting a tree frees both.
 class Tree {
 public:
-    TreeNode *root;
+    static constexpr int root = 0;
+    
+    TreeNodes nodes;
+    // Indexed by TreeNodes::animator; -1 there means no animator. Set with
+    // setAnimators.
+    std::vector<NodeAnimator *> animators;
+    // Bumped whenever animators are (re)assigned to nodes.
+    int animatorGeneration;
     float size;
     
     Tree(float size);
-    Tree(float size, TreeNode *root);
+    ~Tree();
+    Tree(const Tree &other) = delete;
+    Tree &operator=(const Tree &other) = delete;
+    
+    // Takes ownership of animators, which mustn't belong to another tree.
+    // Animators of the previous set that aren't in the new one are deleted.
+    void setAnimators(const std::vector<NodeAnimator *> &animators);
+    
+    // Writes a TreeFile: nodes, parameters, animator ids and the channel
+    // animators' definitions. Returns false, logging why, on failure.
+    bool save(const std::string &path) const;
+    // Maps a TreeFile and uses its nodes in place instead of reading them
+    // one by one; pages are copied only as animation writes to them.
+    // Channel animators are rebuilt; any other animator comes back static,
+    // to be replaced with setAnimators. Returns nullptr, logging why, when
+    // the file is missing, not a TreeFile of this version, or has node
+    // links or cached structure that don't add up.
+    static Tree *load(const std::string &path);
+    
+    int inverseDepth(int node) const {
+        return nodes.height[node];
+    }
 };
 
+// One node of a RenderedTree, in the tree's own coordinates (before the
+// translate/scale the app applies around each drawer).
 struct RenderedTreeNode {
 public:
     ofPoint position;
     float scale;
-    ofVec2f velocity;
+    // Degrees, including the node's own branchAngle.
+    float angle;
+    int parent;
     int depth;
-    int minBranchDepth;
-    int maxBranchDepth;
     ofColor color;
-    std::vector<RenderedTreeNode> children;
-
-    RenderedTreeNode(ofPoint position, float scale, ofVec2f velocity, int depth, int maxBranchDepth, int minBranchDepth, ofColor color):
-    position(position),
-    scale(scale),
-    velocity(velocity),
-    depth(depth),
-    maxBranchDepth(maxBranchDepth),
-    minBranchDepth(minBranchDepth),
-    color(color),
-    children(std::vector<RenderedTreeNode>()) {}
 };
 
+// The node colors TreeRenderer and the drawers use by default, indexed by
+// the height of the node's subtree: leaves first.
+const std::vector<ofColor> &defaultTreePalette();
+// The palette entry for a subtree of the given height, clamped to the last
+// entry; white when the palette is empty.
+ofColor treePaletteColor(const std::vector<ofColor> &palette, int height);
+
+// A circle in tree coordinates; a negative radius is empty.
+struct BoundingCircle {
+public:
+    float x;
+    float y;
+    float radius;
+    
+    BoundingCircle(): x(0), y(0), radius(-1) {}
+    BoundingCircle(float x, float y, float radius): x(x), y(y), radius(radius) {}
+    
+    // The smallest circle enclosing both.
+    BoundingCircle merged(const BoundingCircle &other) const;
+    bool intersects(const ofRectangle &rectangle) const;
+};
+
+// A flat world-space snapshot of a tree, indexed like TreeNodes. It is
+// resized only when the topology changes, so rendering into the same
+// RenderedTree every frame allocates nothing.
 struct RenderedTree {
-    RenderedTreeNode root;
+public:
+    std::vector<RenderedTreeNode> nodes;
+    float size;
+    // The root's size parameter. The transform chain never applies it, but
+    // LeafTreeDrawer's accumulated scale includes it.
+    float rootScale;
+    
+    // Per node, a circle around everything its subtree draws: circles and
+    // leaf lines. Empty unless the renderer's computeBounds is set.
+    std::vector<BoundingCircle> bounds;
+    
+    // The TreeNodes revision this snapshot was rendered at, or -1 before its
+    // first render. Rendering into it again only recomputes nodes that
+    // changed since, so a snapshot should only ever hold one tree.
+    int revision;
+    
+    RenderedTree(): size(0), rootScale(1), revision(-1) {}
+    
+    int count() const {
+        return (int)nodes.size();
+    }
+    
+    // Makes this snapshot alpha of the way from from to to, two snapshots of
+    // the same tree. Positions, scales and angles are blended linearly;
+    // bounds are the merge of both, which still encloses every blended
+    // circle. When the two don't hold the same nodes it becomes a copy of
+    // to. Splits the nodes across the pool, if there is one.
+    void interpolate(const RenderedTree &from, const RenderedTree &to, float alpha, ThreadPool *pool = nullptr, int grainSize = 16384);
+};
+
+// Screen-space level of detail for the circle drawers. A node's circle is
+// radius tree->size / 2 times its accumulated scale; once that projects
+// below minPixelRadius the node and its whole subtree are skipped, which
+// assumes children are no bigger than their parents (size <= 1). Visible
+// circles get just enough segments to keep the chord error under
+// maxPixelError, rounded up to a power of two so they share a few meshes.
+struct LevelOfDetail {
+    bool enabled;
+    // Pixels per drawing unit in the pass the drawer draws into.
+    float pixelsPerUnit;
+    float minPixelRadius;
+    float maxPixelError;
+    
+    LevelOfDetail(): enabled(false), pixelsPerUnit(1), minPixelRadius(0.5), maxPixelError(0.25) {}
+    
+    bool isVisible(float radius) const {
+        return !enabled || radius * pixelsPerUnit >= minPixelRadius;
+    }
+    
+    int segments(float radius, int maxSegments) const;
+};
+
+// Skips subtrees whose bounding circle misses the drawing target.
+struct ViewportCulling {
+    bool enabled;
+    // The target's bounds in tree coordinates.
+    ofRectangle viewport;
+    
+    ViewportCulling(): enabled(false) {}
+    
+    // For a pass that translates to (x, y) and scales by scale before
+    // drawing into a width x height target.
+    void setTransform(float x, float y, float scale, float width, float height);
     
-    RenderedTree(RenderedTreeNode root): root(root) {}
+    // Needs renderedTree.bounds; without them nothing is culled.
+    bool isVisible(const RenderedTree &renderedTree, int node) const {
+        return !enabled || renderedTree.bounds.size() != renderedTree.nodes.size() || renderedTree.bounds[node].intersects(viewport);
+    }
 };
 
-template <typename Data, typename UpData>
+// Runs of consecutive sibling nodes, as (first node, count).
+typedef std::vector<std::pair<int, int>> NodeRanges;
+
+// Nodes that pass both the LOD and culling tests, in index order. Found
+// level by level from the root, so pruned subtrees are never touched.
+// frontier and next are scratch for the levels; callers keep them between
+// calls so that, like visible, they stop allocating once grown.
+void collectVisibleNodes(const Tree *tree, const RenderedTree &renderedTree, const LevelOfDetail &lod, const ViewportCulling &culling, std::vector<int> &visible, NodeRanges &frontier, NodeRanges &next);
+
+// Walks the tree depth-first, calling the hooks below. Subclasses pass
+// themselves as Derived (class CircleTreeDrawer: public
+// TreeVisitor<CircleTreeDrawer, float, bool>) and hide the hooks they need,
+// which are called without virtual dispatch; hooks they leave alone are
+// empty and compile away. Data flows down from modifyData and UpData back
+// up through reduceUpData, both passed by const reference.
+//
+// The walk keeps its own stack instead of recursing, so a tree's depth is
+// limited by memory rather than the call stack.
+template <typename Derived, typename Data, typename UpData>
 class TreeVisitor {
 public:
     Tree *tree;
+    // When set, and the visitor allows it, visitAll forks subtrees larger
+    // than grainSize nodes onto the pool. Hooks for different subtrees then
+    // run concurrently, and each node's children all get preVisit before any
+    // of them is visited, but reduceUpData, visitNodeUp and postVisit still
+    // run in child order on the joined results, so the reduction is the same
+    // as a serial visit.
+    ThreadPool *pool;
+    int grainSize;
+    
+    TreeVisitor(Tree *tree): tree(tree), pool(nullptr), grainSize(4096) {}
+    
+    UpData visitAll(const Data &initialData, const UpData &initialUpData) {
+        if (tree->nodes.count() == 0) {
+            return initialUpData;
+        }
+        if (pool != nullptr && derived().allowsParallelVisit()) {
+            return visitHelperParallel(Tree::root, 0, initialData, initialUpData, 0);
+        }
+        return visitHelper(Tree::root, 0, initialData, initialUpData, stack);
+    }
     
-    TreeVisitor(Tree *tree): tree(tree) {}
-    
-    void visitAll(Data initialData, UpData initialUpData) {
-        visitHelper(tree->root, 0, initialData, initialUpData);
+    // Visitors whose hooks depend on visit order or shared state (GL calls,
+    // ofRandom) return false to always visit serially.
+    bool allowsParallelVisit() {
+        return true;
     }
-        
-    UpData visitHelper(TreeNode *node, int currentDepth, Data data, UpData upData) {
-        visitNode(node, currentDepth, data);
-        
-        Data newData = modifyData(currentDepth, node, data);
-        UpData newUpData = modifyUpData(currentDepth, node, upData);
-        UpData reducedData = newUpData;
-        
-        for (TreeNode *child: node->children) {
-            preVisit(child, currentDepth + 1, newData);
-            reducedData = reduceUpData(visitHelper(child, currentDepth + 1, newData, newUpData), reducedData);
-            visitNodeUp(node, currentDepth + 1, newData, reducedData);
-            postVisit(child, currentDepth + 1, newData);
-        }
-        
-        return reducedData;
+    
+    // Returning false skips the node and its whole subtree; none of the
+    // other hooks run for any of them.
+    bool shouldVisit(int node, int currentDepth, const Data &data) {
+        return true;
     }
     
-    virtual void preVisit(TreeNode *node, int currentDepth, Data data) {
+    void preVisit(int node, int currentDepth, const Data &data) {
     }
     
-    virtual void visitNode(TreeNode *node, int currentDepth, Data data) {
+    void visitNode(int node, int currentDepth, const Data &data) {
     }
     
-    virtual void visitNodeUp(TreeNode *node, int currentDepth, Data data, UpData upData) {
+    void visitNodeUp(int node, int currentDepth, const Data &data, const UpData &upData) {
     }
     
-    virtual void postVisit(TreeNode *node, int currentDepth, Data data) {
+    void postVisit(int node, int currentDepth, const Data &data) {
     }
     
-    virtual Data modifyData(int currentDepth, TreeNode *node, Data data) {
+    Data modifyData(int currentDepth, int node, const Data &data) {
         return data;
     }
     
-    virtual UpData modifyUpData(int currentDepth, TreeNode *node, UpData data) {
+    UpData modifyUpData(int currentDepth, int node, const UpData &data) {
         return data;
     }
     
-    virtual UpData reduceUpData(UpData a, UpData b) {
+    UpData reduceUpData(const UpData &a, const UpData &b) {
         return a;
     }
+    
+private:
+    // A node being visited: what its children get, and its reduction so far.
+    struct Frame {
+        int node;
+        int currentDepth;
+        int nextChild;
+        int lastChild;
+        Data data;
+        UpData upData;
+        UpData reducedData;
+    };
+    
+    static const int maxForkDepth = 32;
+    
+    std::vector<Frame> stack;
+    
+    Derived &derived() {
+        return static_cast<Derived &>(*this);
+    }
+    
+    // Visits node and pushes its frame. data and upData may live in the
+    // frame below, so they are used up before the push.
+    void enter(std::vector<Frame> &stack, int node, int currentDepth, const Data &data, const UpData &upData) {
+        derived().visitNode(node, currentDepth, data);
+        Data newData = derived().modifyData(currentDepth, node, data);
+        UpData newUpData = derived().modifyUpData(currentDepth, node, upData);
+        int firstChild = tree->nodes.firstChild[node];
+        int lastChild = firstChild + tree->nodes.childCount[node];
+        stack.push_back(Frame { node, currentDepth, firstChild, lastChild, std::move(newData), newUpData, newUpData });
+    }
+    
+    UpData visitHelper(int node, int currentDepth, const Data &data, const UpData &upData, std::vector<Frame> &stack) {
+        // Breadth-first order puts the deepest node last.
+        const TreeNodes &nodes = tree->nodes;
+        stack.clear();
+        stack.reserve(nodes.depth[nodes.count() - 1] - nodes.depth[node] + 1);
+        enter(stack, node, currentDepth, data, upData);
+        while (true) {
+            Frame &frame = stack.back();
+            if (frame.nextChild < frame.lastChild) {
+                int child = frame.nextChild++;
+                if (!derived().shouldVisit(child, frame.currentDepth + 1, frame.data)) {
+                    continue;
+                }
+                derived().preVisit(child, frame.currentDepth + 1, frame.data);
+                enter(stack, child, frame.currentDepth + 1, frame.data, frame.upData);
+                continue;
+            }
+            
+            int child = frame.node;
+            UpData childData = std::move(frame.reducedData);
+            stack.pop_back();
+            if (stack.empty()) {
+                return childData;
+            }
+            Frame &parent = stack.back();
+            parent.reducedData = derived().reduceUpData(childData, parent.reducedData);
+            derived().visitNodeUp(parent.node, parent.currentDepth + 1, parent.data, parent.reducedData);
+            derived().postVisit(child, parent.currentDepth + 1, parent.data);
+        }
+    }
+    
+    // Recurses only through forked subtrees, which are larger than grainSize
+    // and at most maxForkDepth levels down, so long chains of large subtrees
+    // can't overflow the call stack either. Each fork walks its subtree with
+    // a stack of its own.
+    UpData visitHelperParallel(int node, int currentDepth, const Data &data, const UpData &upData, int forkDepth) {
+        if (tree->nodes.subtreeSize[node] <= grainSize || forkDepth >= maxForkDepth) {
+            std::vector<Frame> stack;
+            return visitHelper(node, currentDepth, data, upData, stack);
+        }
+        
+        derived().visitNode(node, currentDepth, data);
+        
+        Data newData = derived().modifyData(currentDepth, node, data);
+        UpData newUpData = derived().modifyUpData(currentDepth, node, upData);
+        UpData reducedData = newUpData;
+        
+        int firstChild = tree->nodes.firstChild[node];
+        int childCount = tree->nodes.childCount[node];
+        std::unique_ptr<UpData[]> results(new UpData[childCount]);
+        std::unique_ptr<bool[]> visited(new bool[childCount]);
+        ThreadPool::TaskGroup group;
+        for (int i = 0; i < childCount; i++) {
+            int child = firstChild + i;
+            visited[i] = derived().shouldVisit(child, currentDepth + 1, newData);
+            if (!visited[i]) {
+                continue;
+            }
+            derived().preVisit(child, currentDepth + 1, newData);
+            pool->run(group, [this, &results, &newData, &newUpData, i, child, currentDepth, forkDepth]() {
+                results[i] = visitHelperParallel(child, currentDepth + 1, newData, newUpData, forkDepth + 1);
+            });
+        }
+        pool->wait(group);
+        
+        for (int i = 0; i < childCount; i++) {
+            if (!visited[i]) {
+                continue;
+            }
+            reducedData = derived().reduceUpData(results[i], reducedData);
+            derived().visitNodeUp(node, currentDepth + 1, newData, reducedData);
+            derived().postVisit(firstChild + i, currentDepth + 1, newData);
+        }
+        
+        return reducedData;
+    }
 };
 
-class CircleTreeDrawer: public TreeVisitor<bool, bool> {
+class CircleTreeDrawer: public TreeVisitor<CircleTreeDrawer, float, bool> {
 public:
-    CircleTreeDrawer(Tree *tree): TreeVisitor(tree) {
+    // With lod enabled, sub-pixel subtrees are skipped and each circle's
+    // resolution follows its projected radius, up to resolution.
+    LevelOfDetail lod;
+    int resolution;
+    // With culling enabled, subtrees outside the viewport are skipped, using
+    // the bounds in renderedTree.
+    ViewportCulling culling;
+    const RenderedTree *renderedTree;
+    
+    CircleTreeDrawer(Tree *tree, int resolution = 200): TreeVisitor(tree), resolution(resolution), renderedTree(nullptr), currentResolution(resolution) {
+    }
+    
+    bool allowsParallelVisit() {
+        return false;
     }
     
     void visitAll() {
-        TreeVisitor::visitAll(true, true);
+        currentResolution = resolution;
+        TreeVisitor::visitAll(1, true);
+        if (currentResolution != resolution) {
+            ofSetCircleResolution(resolution);
+        }
     }
     
-    void preVisit(TreeNode *node, int currentDepth, bool data) {
-        ofPushMatrix();
-        
-        ofRotateDeg(node->parameters.terminusAngle);
-        ofTranslate(0, -tree->size/2 - node->parameters.offset * tree->size / 2);
-        ofScale(node->parameters.size);
-        ofRotateDeg(node->parameters.branchAngle);
+    // Data is the scale accumulated above the node. The root's own size is
+    // never applied, matching preVisit, which the root doesn't get.
+    bool shouldVisit(int node, int currentDepth, float scale) {
+        if (culling.enabled && renderedTree != nullptr && !culling.isVisible(*renderedTree, node)) {
+            return false;
+        }
+        return lod.isVisible(tree->size / 2 * scale * tree->nodes.size[node]);
     }
     
-    void visitNode(TreeNode *node, int currentDepth, bool data) {
+    void preVisit(int node, int currentDepth, float scale) {
+        ofPushMatrix();
+        
+        const TreeNodes &nodes = tree->nodes;
+        ofRotateDeg(nodes.terminusAngle[node]);
+        ofTranslate(0, -tree->size/2 - nodes.offset[node] * tree->size / 2);
+        ofScale(nodes.size[node]);
+        ofRotateDeg(nodes.branchAngle[node]);
+    }
+    
+    void visitNode(int node, int currentDepth, float scale) {
+        if (lod.enabled) {
+            float drawnScale = node == Tree::root ? 1 : scale * tree->nodes.size[node];
+            int segments = lod.segments(tree->size / 2 * drawnScale, resolution);
+            if (segments != currentResolution) {
+                ofSetCircleResolution(segments);
+                currentResolution = segments;
+            }
+        }
         ofDrawEllipse(0, 0, tree->size, tree->size);
     }
     
-    void postVisit(TreeNode *node, int currentDepth, bool data) {
+    void postVisit(int node, int currentDepth, float scale) {
         ofPopMatrix();
     }
+    
+    float modifyData(int currentDepth, int node, float scale) {
+        return node == Tree::root ? scale : scale * tree->nodes.size[node];
+    }
+    
+private:
+    int currentResolution;
 };
 
-class LeafTreeDrawer: public TreeVisitor<float, int> {
+class LeafTreeDrawer: public TreeVisitor<LeafTreeDrawer, float, bool> {
 public:
-    LeafTreeDrawer(Tree *tree): TreeVisitor(tree) {
+    // With culling enabled, subtrees outside the viewport are skipped, using
+    // the bounds in renderedTree.
+    ViewportCulling culling;
+    const RenderedTree *renderedTree;
+    
+    LeafTreeDrawer(Tree *tree): TreeVisitor(tree), renderedTree(nullptr) {
+    }
+    
+    bool allowsParallelVisit() {
+        return false;
     }
     
     void visitAll() {
-        TreeVisitor::visitAll(1, -1);
+        TreeVisitor::visitAll(1, true);
+    }
+    
+    bool shouldVisit(int node, int currentDepth, float currentScale) {
+        return !culling.enabled || renderedTree == nullptr || culling.isVisible(*renderedTree, node);
     }
     
-    void preVisit(TreeNode *node, int currentDepth, float currentScale) {
+    void preVisit(int node, int currentDepth, float currentScale) {
         ofPushMatrix();
         
-        ofRotateDeg(node->parameters.terminusAngle);
-        ofTranslate(0, -tree->size/2 - node->parameters.offset * tree->size / 2);
-        ofScale(node->parameters.size);
-        ofRotateDeg(node->parameters.branchAngle);
+        const TreeNodes &nodes = tree->nodes;
+        ofRotateDeg(nodes.terminusAngle[node]);
+        ofTranslate(0, -tree->size/2 - nodes.offset[node] * tree->size / 2);
+        ofScale(nodes.size[node]);
+        ofRotateDeg(nodes.branchAngle[node]);
     }
     
-    void visitNode(TreeNode *node, int currentDepth, float currentScale) {
+    void visitNode(int node, int currentDepth, float currentScale) {
 //        if (node->children.size() == 0) {
 //            ofPushMatrix();
 //            ofScale(1.0/currentScale);
@@ -218,24 +642,16 @@ public:
 //        }
     }
     
-    void visitNodeUp(TreeNode *node, int currentDepth, float currentScale, int maxDepth) {
-//        cout << node->inverseDepth() << ":" << currentDepth << ":" << maxDepth << "\n";
-        
+    // Each node's line is drawn in its own frame, colored by its subtree's
+    // height.
+    void drawLine(int height, float currentScale) {
 //        ofColor c;
-        if (maxDepth - currentDepth == 0) {
-//            c = ofColor(0.5, 0.8, 0.9);
-//            ofSetColor(ofColor_(ofColor::fromHsb(0.5, 0.8, 0.9)));
-            ofSetColor(ofColor::fromHsb(150, 240, 230, 200));
-        } else if (maxDepth - currentDepth == 1) {
-            ofSetColor(ofColor::fromHsb(30, 255, 250, 240));
-        } else if (maxDepth - currentDepth == 2) {
-            ofSetColor(255, 0, 0, 145);
-        } else {
-            ofSetColor(255, 200, 200, 100);
-        }
-        
+//        c = ofColor(0.5, 0.8, 0.9);
+//        ofSetColor(ofColor_(ofColor::fromHsb(0.5, 0.8, 0.9)));
+        ofSetColor(treePaletteColor(defaultTreePalette(), height));
+
 
-//        if (maxDepth - currentDepth < 1) {
+//        if (height < 1) {
             ofPushMatrix();
             ofScale(1.0/currentScale);
 //            ofSetColor(255, 0, 0, 255);
@@ -245,44 +661,42 @@ public:
 //        }
     }
     
-    void postVisit(TreeNode *node, int currentDepth, float currentScale) {
+    void postVisit(int node, int currentDepth, float currentScale) {
+        drawLine(tree->nodes.height[node], currentScale);
         ofPopMatrix();
     }
     
-    float modifyData(int currentDepth, TreeNode *node, float currentScale) {
-        return currentScale * node->parameters.size;
-    }
-    
-    int modifyUpData(int currentDepth, TreeNode *node, int upData) {
-        return upData + 1;
-    }
-    
-    int reduceUpData(int a, int b) {
-        return max(a, b);
+    float modifyData(int currentDepth, int node, float currentScale) {
+        return currentScale * tree->nodes.size[node];
     }
 };
 
 
 
-class BranchTreeDrawer: public TreeVisitor<TreeNode *, int> {
+class BranchTreeDrawer: public TreeVisitor<BranchTreeDrawer, int, bool> {
 public:
     BranchTreeDrawer(Tree *tree): TreeVisitor(tree) {
     }
     
+    bool allowsParallelVisit() {
+        return false;
+    }
+    
     void visitAll() {
-        TreeVisitor::visitAll(nullptr, -1);
+        TreeVisitor::visitAll(-1, true);
     }
     
-    void preVisit(TreeNode *node, int currentDepth, float currentScale) {
+    void preVisit(int node, int currentDepth, int parentNode) {
         ofPushMatrix();
         
-        ofRotateDeg(node->parameters.terminusAngle);
-        ofTranslate(0, -tree->size/2 - node->parameters.offset * tree->size / 2);
-        ofScale(node->parameters.size);
-        ofRotateDeg(node->parameters.branchAngle);
+        const TreeNodes &nodes = tree->nodes;
+        ofRotateDeg(nodes.terminusAngle[node]);
+        ofTranslate(0, -tree->size/2 - nodes.offset[node] * tree->size / 2);
+        ofScale(nodes.size[node]);
+        ofRotateDeg(nodes.branchAngle[node]);
     }
     
-    void visitNode(TreeNode *node, int currentDepth, TreeNode *parentNode) {
+    void visitNode(int node, int currentDepth, int parentNode) {
         //        if (node->children.size() == 0) {
         //            ofPushMatrix();
         //            ofScale(1.0/currentScale);
@@ -291,7 +705,7 @@ public:
         //        }
     }
     
-    void visitNodeUp(TreeNode *node, int currentDepth, TreeNode *parentNode, int maxDepth) {
+    void visitNodeUp(int node, int currentDepth, int parentNode, bool upData) {
 //        //        cout << node->inverseDepth() << ":" << currentDepth << ":" << maxDepth << "\n";
 //        
 //        //        ofColor c;
@@ -318,101 +732,220 @@ public:
 //        //        }
     }
     
-    void postVisit(TreeNode *node, int currentDepth, TreeNode *parentNode) {
+    void postVisit(int node, int currentDepth, int parentNode) {
         ofPopMatrix();
     }
-    
-//    TreeNode *parentNode modifyData(int currentDepth, TreeNode *node, TreeNode *parentNode) {
+
+//    int parentNode modifyData(int currentDepth, int node, int parentNode) {
 //        return parentNode;
 //    }
-    
-    int modifyUpData(int currentDepth, TreeNode *node, int upData) {
-        return upData + 1;
-    }
-    
-    int reduceUpData(int a, int b) {
-        return max(a, b);
-    }
 };
 
-class TreeRenderer: public TreeVisitor<RenderedTreeNode, RenderedTreeNode> {
-    RenderedTree *renderedTree;
-    
-    TreeRenderer(Tree *tree): TreeVisitor(tree), renderedTree(nullptr) {
+// Fills RenderedTree::bounds bottom-up: each node's own circle comes from
+// modifyUpData and reduceUpData merges in the children's, so visitNodeUp's
+// last call for a node sees its whole subtree.
+class TreeBoundsVisitor: public TreeVisitor<TreeBoundsVisitor, bool, BoundingCircle> {
+public:
+    TreeBoundsVisitor(Tree *tree): TreeVisitor(tree), renderedTree(nullptr) {
     }
     
-//    void visitAll
-    
-    void preVisit(TreeNode *node, int currentDepth, int data) {
-        ofPushMatrix();
-        
-        ofRotateDeg(node->parameters.terminusAngle);
-        ofTranslate(0, -tree->size/2 - node->parameters.offset * tree->size / 2);
-        ofScale(node->parameters.size);
-        ofRotateDeg(node->parameters.branchAngle);
+    void visitAll(RenderedTree &renderedTree) {
+        this->renderedTree = &renderedTree;
+        renderedTree.bounds.resize(renderedTree.nodes.size());
+        TreeVisitor::visitAll(true, BoundingCircle());
     }
-
-    void visitNode(TreeNode *node, int currentDepth, int data) {
-        ofMatrix4x4 matrix = ofMatrix4x4(ofGetCurrentMatrix(ofMatrixMode::OF_MATRIX_MODELVIEW));
-        ofVec4f point = ofVec4f(0, 0, 0, 1);
-        point = matrix * point;
-        
-        RenderedTreeNode renderedNode = RenderedTreeNode(ofPoint(point.x, point.y), matrix.getScale().x, ofVec2f(0, 0), currentDepth, 0, 0, ofColor(255, 255, 255, 255));
-        
-        if (currentDepth == 0) {
-            renderedTree = new RenderedTree(renderedNode);
+    
+    BoundingCircle modifyUpData(int currentDepth, int node, const BoundingCircle &upData) {
+        // Leaf lines run about size / rootScale * sqrt(2) from the node, as
+        // in LeafBatchDrawer.
+        const RenderedTreeNode &rendered = renderedTree->nodes[node];
+        float radius = renderedTree->size / 2 * rendered.scale;
+        if (node != Tree::root) {
+            float line = rendered.scale / (renderedTree->nodes[rendered.parent].scale * renderedTree->rootScale);
+            radius = max(radius, line * (float)M_SQRT2);
         }
+        BoundingCircle own(rendered.position.x, rendered.position.y, radius);
+        renderedTree->bounds[node] = own;
+        return own;
     }
     
-    void visitNodeUp(TreeNode *node, int currentDepth, int data, RenderedTreeNode upData) {
-        
+    void visitNodeUp(int node, int currentDepth, bool data, const BoundingCircle &upData) {
+        renderedTree->bounds[node] = upData;
     }
     
-    void postVisit(TreeNode *node, int currentDepth, int data) {
-        ofPopMatrix();
+    BoundingCircle reduceUpData(const BoundingCircle &a, const BoundingCircle &b) {
+        return a.merged(b);
     }
+    
+private:
+    RenderedTree *renderedTree;
+};
 
+// Composes every node's world transform without touching the GL matrix
+// stack. The chain is the one the drawers' preVisit applies (rotate by
+// terminusAngle, translate out along the rotated y axis, scale, rotate by
+// branchAngle), done as 2D affine math in one forward sweep, since parents
+// precede children in the node arrays.
+//
+// A node's world transform only changes when its own parameters or its
+// parent's transform do, so the sweep carries each node's newest revision
+// down from the root and skips nodes the target snapshot already has.
+// Subtrees under static animators cost a comparison per node.
+class TreeRenderer {
+public:
+    Tree *tree;
+    // Node colors, indexed by the height of the node's subtree and clamped
+    // to the last entry. Starts as defaultTreePalette().
+    std::vector<ofColor> palette;
+    // When set, each depth level is split across the pool; a level only
+    // reads the one above it, which is finished by then.
+    ThreadPool *pool;
+    int grainSize;
+    // Also fill RenderedTree::bounds, for viewport culling.
+    bool computeBounds;
+    // When cleared, every render recomputes every node.
+    bool incremental;
+    // Nodes whose transform the last render recomputed.
+    int updatedNodes;
+    
+    TreeRenderer(Tree *tree);
+    
+    void render(RenderedTree &renderedTree);
+    
+private:
+    // levelStarts[d] is the first node at depth d, with a final entry for
+    // the node count.
+    std::vector<int> levelStarts;
+    // The newest revision among each node's parameters and its ancestors'.
+    std::vector<int> worldRevision;
+    TreeBoundsVisitor boundsVisitor;
+    
+    // Parents, depths and colors only depend on the topology.
+    void renderTopology(RenderedTree &renderedTree);
+    // Returns how many nodes it recomputed, those newer than since.
+    int renderRange(RenderedTree &renderedTree, int begin, int end, int since);
 };
 
-class TreeAnimator: public TreeVisitor<float, bool> {
+// Animates the tree one animator at a time. Nodes are grouped by animator
+// id once per assignment, so each animator runs over its whole group in one
+// batch instead of being looked up per node. Animated nodes are touched so
+// TreeRenderer picks them up; static animators are skipped altogether.
+class TreeAnimator {
 public:
-    TreeAnimator(Tree *tree): TreeVisitor(tree) {
+    Tree *tree;
+    
+    // When set, each group is split into chunks of at least grainSize nodes
+    // animated across the pool.
+    ThreadPool *pool;
+    int grainSize;
+    // When set, animate() plays the track instead of running the animators.
+    AnimationTrack *track;
+    
+    TreeAnimator(Tree *tree): tree(tree), pool(nullptr), grainSize(16384), track(nullptr), generation(-1), nodeCount(-1) {
     }
     
-    void visitNode(TreeNode *node, int currentDepth, float dt) {
-        if (node->animator != nullptr) {
-            node->animator->applyTo(node, dt);
+    void animate(float dt) {
+        TreeNodes &nodes = tree->nodes;
+        if (track != nullptr) {
+            track->apply(nodes, dt, pool, grainSize);
+            return;
         }
+        if (generation != tree->animatorGeneration || nodeCount != nodes.count()) {
+            regroup();
+        }
+        for (int animator = 0; animator < (int)groups.size(); animator++) {
+            const std::vector<int> &group = groups[animator];
+            NodeAnimator *nodeAnimator = tree->animators[animator];
+            if (group.empty() || nodeAnimator->isStatic()) {
+                continue;
+            }
+            if (pool == nullptr) {
+                apply(nodeAnimator, group.data(), (int)group.size(), scratch.data(), dt);
+                continue;
+            }
+            // Chunks touch disjoint nodes and disjoint stretches of scratch.
+            pool->parallelFor(0, (int)group.size(), grainSize, [&](int begin, int end) {
+                apply(nodeAnimator, group.data() + begin, end - begin, scratch.data() + begin, dt);
+            });
+        }
+    }
+    
+private:
+    std::vector<std::vector<int>> groups;
+    std::vector<float> scratch;
+    int generation;
+    int nodeCount;
+    
+    void apply(NodeAnimator *nodeAnimator, const int *group, int count, float *scratch, float dt) {
+        TreeNodes &nodes = tree->nodes;
+        nodeAnimator->applyTo(nodes, group, count, scratch, dt);
+        for (int i = 0; i < count; i++) {
+            nodes.touch(group[i]);
+        }
+    }
+    
+    void regroup() {
+        const TreeNodes &nodes = tree->nodes;
+        groups.assign(tree->animators.size(), std::vector<int>());
+        for (int node = 0; node < nodes.count(); node++) {
+            int animator = nodes.animator[node];
+            if (animator >= 0 && animator < (int)groups.size()) {
+                groups[animator].push_back(node);
+            }
+        }
+        size_t largest = 0;
+        for (const std::vector<int> &group: groups) {
+            largest = max(largest, group.size());
+        }
+        scratch.resize(largest);
+        generation = tree->animatorGeneration;
+        nodeCount = nodes.count();
     }
 };
 
-typedef NodeAnimator* (*AnimatorChooser)(TreeNode *, int, std::vector<NodeAnimator *>);
+typedef NodeAnimator* (*AnimatorChooser)(Tree *, int, int, const std::vector<NodeAnimator *> &);
 
-class TreeAnimatorInstaller: public TreeVisitor<bool, bool> {
+class TreeAnimatorInstaller: public TreeVisitor<TreeAnimatorInstaller, bool, bool> {
     std::vector<NodeAnimator *> animators;
     AnimatorChooser animatorChooser;
+    // Each animator's id, its first index in animators, so visitNode can
+    // store the chooser's pick without searching the list per node.
+    std::unordered_map<NodeAnimator *, int> animatorIds;
     
 public:
     TreeAnimatorInstaller(Tree *tree,
                           std::vector<NodeAnimator *> animators,
                           AnimatorChooser chooser):
     TreeVisitor(tree), animators(animators), animatorChooser(chooser) {
+        for (int i = 0; i < (int)this->animators.size(); i++) {
+            animatorIds.emplace(this->animators[i], i);
+        }
+    }
+    
+    // Choosers may draw from ofRandom, which isn't thread safe.
+    bool allowsParallelVisit() {
+        return false;
     }
     
+    // The tree takes ownership of the animators.
     void visitAll() {
+        tree->setAnimators(animators);
         TreeVisitor::visitAll(true, true);
+        tree->animatorGeneration++;
     }
     
-    void preVisit(TreeNode *node, int currentDepth, bool data) {
+    void preVisit(int node, int currentDepth, bool data) {
     }
     
-    void visitNode(TreeNode *node, int currentDepth, bool data) {
+    void visitNode(int node, int currentDepth, bool data) {
 //        if (currentDepth != 0) {
-            node->animator = animatorChooser(node, currentDepth, animators);
+            NodeAnimator *animator = animatorChooser(tree, node, currentDepth, animators);
+            auto found = animatorIds.find(animator);
+            tree->nodes.animator[node] = found == animatorIds.end() ? -1 : found->second;
 //        }
     }
     
-    void postVisit(TreeNode *node, int currentDepth, bool data) {
+    void postVisit(int node, int currentDepth, bool data) {
     }
 };
 
@@ -420,32 +953,49 @@ class TreeGenerator {
 public:
     int depth;
     int size;
+    // Children per inner node. The root gets twice as many.
+    int fanOut;
     
-    TreeGenerator(int depth, int size): depth(depth), size(size) {
+    TreeGenerator(int depth, int size, int fanOut = 4): depth(depth), size(size), fanOut(fanOut) {
     }
     
-    Tree *generateTree() {
-        TreeNode *root = generateHelper(depth - 1, BranchParameters(), true);
-        return new Tree(size * 2, root);
+    int nodeCount() const {
+        int count = 1;
+        int level = fanOut * 2;
+        for (int d = 1; d < depth; d++) {
+            count += level;
+            level *= fanOut;
+        }
+        return count;
     }
     
-    TreeNode *generateHelper(int remainingDepth, BranchParameters parameters, bool initial) {
-        TreeNode *node = new TreeNode(parameters);
+    Tree *generateTree() {
+        Tree *tree = new Tree(size * 2);
+        TreeNodes &nodes = tree->nodes;
+        nodes.reserve(nodeCount());
+        nodes.add(BranchParameters(), -1);
         
+        // Nodes are expanded in index order, so children are appended
+        // breadth-first and each sibling group stays contiguous.
         float scale = 0.4;
-        if (remainingDepth > 0) {
-            if (initial) {
-                for (int i = 0; i < 8; i++) {
-                    node->children.push_back(generateHelper(remainingDepth - 1, BranchParameters(1, 0, (float)i * 360.0 / 8.0, scale, 0), false));
+        for (int node = 0; node < nodes.count(); node++) {
+            int remainingDepth = depth - 1 - nodes.depth[node];
+            if (remainingDepth <= 0) {
+                continue;
+            }
+            if (node == Tree::root) {
+                for (int i = 0; i < fanOut * 2; i++) {
+                    nodes.add(BranchParameters(1, 0, (float)i * 360.0 / (fanOut * 2), scale, 0), node, false);
                 }
             } else {
-                for (int i = 1; i <= 4; i++) {
+                for (int i = 1; i <= fanOut; i++) {
                     float a = (float)i * 360.0 / ((float)remainingDepth * 2) - 360.0 / (float)remainingDepth;
-                    node->children.push_back(generateHelper(remainingDepth - 1, BranchParameters(1, 0, a, scale, 0), false));
+                    nodes.add(BranchParameters(1, 0, a, scale, 0), node, false);
                 }
             }
         }
-        return node;
+        nodes.updateStructure();
+        return tree;
     }
 };
 
@@ -1,13 +1,42 @@
 #include "ofMain.h"
 #include "ofApp.h"
+#include "OfflineRender.hpp"
 
 //========================================================================
-int main( ){
+int main(int argc, char *argv[]){
 
 	//Use ofGLFWWindowSettings for more options like multi-monitor fullscreen
 	ofGLFWWindowSettings settings;
+
+	// Offline rendering: an invisible window hosts the GL context and frames
+	// go straight to disk. See OfflineRenderSettings::usage().
+	OfflineRenderSettings render;
+	bool offline = render.parse(argc, argv);
+	if (offline && render.software) {
+		// No GL at all: a windowless loop drives the app and SoftwareCanvas
+		// draws the frames, so this runs on machines without a GPU.
+		ofInit();
+		ofWindowSettings windowSettings;
+		windowSettings.setSize(render.width, render.height);
+		auto window = std::make_shared<ofAppNoWindow>();
+		ofGetMainLoop()->addWindow(window);
+		window->setup(windowSettings);
+		ofRunApp(window, make_shared<OfflineRenderApp>(render));
+		ofRunMainLoop();
+		return 0;
+	}
+	if (offline) {
+		settings.setGLVersion(3, 2);
+		settings.setSize(render.width, render.height);
+		settings.visible = false;
+		auto window = ofCreateWindow(settings);
+		ofRunApp(window, make_shared<OfflineRenderApp>(render));
+		ofRunMainLoop();
+		return 0;
+	}
 //    settings.setSize(2048, 1024);
 	settings.windowMode = OF_WINDOW; //can also be OF_FULLSCREEN
+	settings.setGLVersion(3, 2); // instanced drawing in BatchDrawers needs GLSL 150
 
 	auto window = ofCreateWindow(settings);
 
@@ -1,15 +1,80 @@
 #include "ofApp.h"
 #include "Trees.hpp"
+#include "BatchDrawers.hpp"
+#include "TreePipeline.hpp"
+#include "FrameProfiler.hpp"
+#include "SoftwareCanvas.hpp"
+#include "AnimationTrack.hpp"
+#include "Forest.hpp"
+#include "SimulationClock.hpp"
+#include "AnimatorScript.hpp"
+#include "SpatialIndex.hpp"
 #include <stdio.h>
 #include <math.h>
 
 Tree *tree;
 CircleTreeDrawer *drawer;
+CircleBatchDrawer *circleBatchDrawer;
 LeafTreeDrawer *leafDrawer;
+LeafBatchDrawer *leafBatchDrawer;
+TreeRenderer *renderer;
+TreePipeline *pipeline;
+const RenderedTree *renderedTree;
+// Immediate mode's own snapshot, only for the culling bounds.
+RenderedTree immediateTree;
+// The pipeline's last two snapshots blended for the time being drawn.
+RenderedTree interpolatedTree;
+SimulationClock simulationClock;
+uint64_t simulatedFrame = 0;
+ThreadPool *threadPool;
 TreeAnimator *animator;
+AnimationTrack *track;
+// Set when animatorFile is, and kept across scenes.
+AnimatorScript *animatorScript;
+float nextAnimatorCheck = 0;
+// Set in forest mode, which always draws batched and bypasses the pipeline.
+Forest *forest;
 int frameRate = 120;
+int circleResolution = 200;
+bool batched = true;
+bool culled = true;
+bool detailed = true;
+
+// Hover and selection. Ids are node indices, or forest.nodes() indices in
+// forest mode.
+SpatialIndex spatialIndex;
+bool indexCurrent = false;
+// Whether the mouse picks in the circles view rather than the leaves view.
+bool pickingCircles = false;
+int hoveredNode = -1;
+std::vector<int> selectedNodes;
+// Where the drag selecting a rectangle started, in tree coordinates.
+ofPoint pressPoint;
+bool dragging = false;
+// Outlining every node of a large selection would cost more than drawing
+// the tree.
+const int maxOutlinedNodes = 2000;
+
+FrameProfiler *profiler;
+struct {
+    int update;
+    int wait;
+    int leaves;
+    int blit;
+    int circles;
+} phases;
+struct {
+    int nodes;
+    int drawCalls;
+    int vertices;
+    int transforms;
+    int steps;
+} counters;
 
 ofFbo drawBuffer;
+// drawBuffer and the window, when drawing on the CPU.
+SoftwareCanvas softwareLeaves;
+SoftwareCanvas softwareFrame;
 
 int getRetinaScale() {
     auto window = dynamic_cast<ofAppGLFWWindow*>(ofGetWindowPtr());
@@ -22,110 +87,249 @@ int getRetinaScale() {
 int bufferWidth;
 int bufferHeight;
 int screenScale;
-int windowWidth;
-int windowHeight;
+
+// The view under window x: the circles pass draws to the right of the
+// leaves pass, when it draws at all.
+bool overCircles(int x) {
+    return forest == nullptr && screenScale / 2 > 0 && x >= ofGetWidth() * 7 / 12;
+}
+
+// The transform draw() applies in the view being picked in.
+void getPickingView(float &originX, float &originY, float &scale) {
+    if (forest != nullptr) {
+        originX = 0;
+        originY = 0;
+        scale = 1;
+    } else if (pickingCircles) {
+        originX = ofGetWidth() / 6 * 5;
+        originY = ofGetHeight() / 2;
+        scale = screenScale / 2;
+    } else {
+        originX = ofGetWidth() / 3;
+        originY = ofGetHeight() / 2;
+        scale = screenScale;
+    }
+}
 
 //--------------------------------------------------------------
 void ofApp::setup(){
-    ofSetRandomSeed(ofGetSystemTimeMillis());
+    ofSetRandomSeed(randomSeed != 0 ? randomSeed : ofGetSystemTimeMillis());
     
-    windowWidth = 1500;
-    windowHeight = 1000;
     screenScale = getRetinaScale();
     ofSetWindowShape(windowWidth * screenScale, windowHeight * screenScale);
+    
+    threadPool = new ThreadPool();
+    
+    profiler = new FrameProfiler();
+    phases.update = profiler->addPhase("update");
+    phases.wait = profiler->addPhase("wait");
+    phases.leaves = profiler->addPhase("leaves");
+    phases.blit = profiler->addPhase("blit");
+    phases.circles = profiler->addPhase("circles");
+    counters.nodes = profiler->addCounter("nodes");
+    counters.drawCalls = profiler->addCounter("draw calls");
+    counters.vertices = profiler->addCounter("vertices");
+    counters.transforms = profiler->addCounter("transforms");
+    counters.steps = profiler->addCounter("simulation steps");
+    
+    simulationClock = SimulationClock(simulationRate);
+    
+    animatorScript = nullptr;
+    if (!animatorFile.empty()) {
+        animatorScript = new AnimatorScript(ofToDataPath(animatorFile));
+        animatorScript->load();
+    }
+    
+    detailed = lodPixelRadius > 0;
+    buildScene();
+    
+    ofSetCircleResolution(circleResolution);
+//    ofEnableBlendMode(OF_BLENDMODE_SCREEN);
+    
+    ofSetFrameRate(frameRate);
+    
+    bufferWidth = ofGetWidth() * screenScale;
+    bufferHeight = ofGetHeight() * screenScale;
+    
+    if (softwareRendering) {
+        softwareLeaves.pool = threadPool;
+        softwareLeaves.allocate(bufferWidth, bufferHeight);
+        softwareLeaves.clear(ofFloatColor(0, 0, 0, 0));
+        softwareFrame.pool = threadPool;
+        softwareFrame.allocate(ofGetWidth(), ofGetHeight());
+    } else {
+        drawBuffer.allocate(bufferWidth, bufferHeight);
+        drawBuffer.begin();
+        ofClear(0, 0, 0);
+        drawBuffer.end();
+    }
 
-    TreeGenerator generator = TreeGenerator(4, windowHeight / 6);
-    tree = generator.generateTree();
+//    ofSetColor(200,200,220,200);
+//        ofSetColor(255, 0, 0, 50);
+    ofFill();
+    ofBackground(255, 255, 255);
     
-    drawer = new CircleTreeDrawer(tree);
-    leafDrawer = new LeafTreeDrawer(tree);
+}
+
+//--------------------------------------------------------------
+void ofApp::buildScene(){
+    uint64_t start = ofGetElapsedTimeMicros();
     
+    // A snapshot brings its own animator assignments.
+    tree = treeFile.empty() ? nullptr : Tree::load(treeFile);
+    bool loaded = tree != nullptr;
+    if (!loaded) {
+        TreeGenerator generator = TreeGenerator(treeDepth, treeSize > 0 ? treeSize : windowHeight / 6);
+        tree = generator.generateTree();
+    }
+    
+    drawer = new CircleTreeDrawer(tree, circleResolution);
+    circleBatchDrawer = new CircleBatchDrawer(tree, circleResolution);
+    leafDrawer = new LeafTreeDrawer(tree);
+    leafBatchDrawer = new LeafBatchDrawer(tree);
+    renderer = new TreeRenderer(tree);
+    renderer->pool = threadPool;
     animator = new TreeAnimator(tree);
-        
-    NodeAnimator *nodeAnimator1 =
-    new NodeAnimator(
-                     NodeAnimatorFunctions(nullptr,
-                                           nullptr,
-                                           [](float v, float d) -> float { return sin(d/2+v/100) * 90 - 45; },
-                                           [](float v, float d) -> float { return 0.4 + sinf(d) * 0.1; },
-                                           [](float v, float d) -> float { return 0.1 + cosf(d/20) * 0.1; }
-                                           )
-                     );
-
-    NodeAnimator *nodeAnimator2 =
-    new NodeAnimator(
-                     NodeAnimatorFunctions(nullptr,
-                                           nullptr,
-                                           [](float v, float d) -> float { return cos(d/5+v/50) * 30 - 15; },
-                                           [](float v, float d) -> float { return 0.3 + sinf(d/2) * 0.1; },
-                                           [](float v, float d) -> float { return 0 + cosf(d/30) * 0.3; }
-                                           )
-                     );
-
-    NodeAnimator *nodeAnimator3 =
-    new NodeAnimator(
-                     NodeAnimatorFunctions(nullptr,
-                                           nullptr,
-                                           [](float v, float d) -> float { return sin(d+v/320) * 180 - 90; },
-                                           [](float v, float d) -> float { return 0.5 + sinf(sqrt(d)) * 0.1; },
-                                           [](float v, float d) -> float { return 0.2 + cosf(d/10) * 0.3; }
-                                           )
-                     );
+    animator->pool = threadPool;
+    
+    if (!loaded) {
+        installAnimators();
+    }
+    track = trackFile.empty() ? nullptr : AnimationTrack::open(trackFile);
+    if (track != nullptr && track->nodeCount() != tree->nodes.count()) {
+        ofLogError("ofApp") << trackFile << " was recorded from a tree of " << track->nodeCount() << " nodes, not " << tree->nodes.count();
+        delete track;
+        track = nullptr;
+    }
+    if (track != nullptr) {
+        track->loop = true;
+        animator->track = track;
+    }
+    
+    forest = nullptr;
+    if (forestSize > 0) {
+        plantForest();
+    }
+    
+    // The first step is drawn until the clock makes the next one due. The
+    // worker stays a step ahead of the drawers from here on.
+    pipeline = new TreePipeline(animator, renderer);
+    pipeline->setProfiler(profiler);
+    simulationClock.reset();
+    if (forest != nullptr) {
+        forest->animate(animationTime(simulatedFrame++));
+        forest->render();
+    } else {
+        renderer->computeBounds = culled;
+        pipeline->submit(animationTime(simulatedFrame++));
+        pipeline->waitIdle();
+        renderedTree = &pipeline->acquire();
+        pipeline->submit(animationTime(simulatedFrame++));
+    }
+    
+    setLevelOfDetail(detailed);
+    
+    int builtNodes = forest != nullptr ? forest->instanceCount() * forest->nodeCount() : tree->nodes.count();
+    ofLogNotice("ofApp") << "built " << builtNodes << " nodes in " << (ofGetElapsedTimeMicros() - start) / 1000.0 << " ms";
+}
 
+//--------------------------------------------------------------
+void ofApp::plantForest(){
+    forest = new Forest(tree);
+    forest->pool = threadPool;
+    batched = true;
     
+    // A grid of roughly square cells over the window, one tree per cell,
+    // sized so a tree about twice its root circle fits.
+    float width = ofGetWidth();
+    float height = ofGetHeight();
+    int columns = max(1, (int)ceilf(sqrtf(forestSize * width / height)));
+    int rows = (forestSize + columns - 1) / columns;
+    float cellWidth = width / columns;
+    float cellHeight = height / rows;
+    float scale = min(cellWidth, cellHeight) / (tree->size * 2);
+    for (int i = 0; i < forestSize; i++) {
+        forest->add(ForestInstance((i % columns + 0.5f) * cellWidth,
+                                   (i / columns + 0.5f) * cellHeight,
+                                   scale * ofRandom(0.8, 1.2),
+                                   ofRandom(360),
+                                   ofRandom(30),
+                                   1 + (uint32_t)ofRandom(0x7fffffff)));
+    }
+    // Copies the tree's parameters before anything animates it.
+    forest->reset();
+}
+
+//--------------------------------------------------------------
+void ofApp::installAnimators(){
+    if (animatorScript != nullptr && animatorScript->animatorCount() > 0) {
+        // Every scripted animator is as likely as the others.
+        AnimatorChooser chooser = [](Tree *tree, int node, int depth, const std::vector<NodeAnimator *> &animators) -> NodeAnimator* {
+            return animators[ofRandom(animators.size())];
+        };
+        TreeAnimatorInstaller scriptInstaller = TreeAnimatorInstaller(tree,
+                                                                      animatorScript->createAnimators(),
+                                                                      chooser);
+        scriptInstaller.visitAll();
+        return;
+    }
+    
+    // Closed-form channels, so TreeAnimator can evaluate them in SIMD
+    // batches. The first three are closed forms of the original per-node
+    // lambdas.
     std::vector<NodeAnimator *> allAnimators = {
         new NodeAnimator(
-                         NodeAnimatorFunctions(nullptr,
-                                               nullptr,
-                                               [](float v, float d) -> float { return sin(d/2+v/100) * 90 - 45; },
-                                               [](float v, float d) -> float { return 0.4 + sinf(d) * 0.1; },
-                                               [](float v, float d) -> float { return 0.1 + cosf(d/20) * 0.1; }
-                                               )
+                         NodeAnimatorChannels(AnimatorChannel::constant(),
+                                              AnimatorChannel::constant(),
+                                              AnimatorChannel::sine(-45, 90, 1.0/2, 1.0/100),
+                                              AnimatorChannel::sine(0.4, 0.1, 1),
+                                              AnimatorChannel::cosine(0.1, 0.1, 1.0/20)
+                                              )
                          ),
         new NodeAnimator(
-                         NodeAnimatorFunctions(nullptr,
-                                               nullptr,
-                                               [](float v, float d) -> float { return cos(d/5+v/50) * 30 - 15; },
-                                               [](float v, float d) -> float { return 0.3 + sinf(d/2) * 0.1; },
-                                               [](float v, float d) -> float { return 0 + cosf(d/30) * 0.3; }
-                                               )
+                         NodeAnimatorChannels(AnimatorChannel::constant(),
+                                              AnimatorChannel::constant(),
+                                              AnimatorChannel::cosine(-15, 30, 1.0/5, 1.0/50),
+                                              AnimatorChannel::sine(0.3, 0.1, 1.0/2),
+                                              AnimatorChannel::cosine(0, 0.3, 1.0/30)
+                                              )
                          ),
         new NodeAnimator(
-                         NodeAnimatorFunctions(nullptr,
-                                               nullptr,
-                                               [](float v, float d) -> float { return sin(d+v/320) * 180 - 90; },
-                                               [](float v, float d) -> float { return 0.5 + sinf(sqrt(d)) * 0.1; },
-                                               [](float v, float d) -> float { return 0.2 + cosf(d/10) * 0.3; }
-                                               )
+                         NodeAnimatorChannels(AnimatorChannel::constant(),
+                                              AnimatorChannel::constant(),
+                                              AnimatorChannel::sine(-90, 180, 1, 1.0/320),
+                                              AnimatorChannel::sine(0.5, 0.1, 1).ofSqrtTime(),
+                                              AnimatorChannel::cosine(0.2, 0.3, 1.0/10)
+                                              )
                          ),
         new NodeAnimator(
-                         NodeAnimatorFunctions(nullptr,
-                                               nullptr,
-                                               [](float v, float d) -> float { return v + 1; },
-                                               [](float v, float d) -> float { return 0.5 + sinf(d) * 0.1; },
-                                               [](float v, float d) -> float { return 0.2 + cosf(d/10) * 0.3; }
-                                               )
+                         NodeAnimatorChannels(AnimatorChannel::constant(),
+                                              AnimatorChannel::constant(),
+                                              AnimatorChannel::drift(1),
+                                              AnimatorChannel::sine(0.5, 0.1, 1),
+                                              AnimatorChannel::cosine(0.2, 0.3, 1.0/10)
+                                              )
                          ),
         new NodeAnimator(
-                         NodeAnimatorFunctions(nullptr,
-                                               nullptr,
-                                               [](float v, float d) -> float { return v + 0.5; },
-                                               [](float v, float d) -> float { return 0.5 + sinf(d) * 0.1; },
-                                               [](float v, float d) -> float { return 0.2 + cosf(d/10) * 0.3; }
-                                               )
+                         NodeAnimatorChannels(AnimatorChannel::constant(),
+                                              AnimatorChannel::constant(),
+                                              AnimatorChannel::drift(0.5),
+                                              AnimatorChannel::sine(0.5, 0.1, 1),
+                                              AnimatorChannel::cosine(0.2, 0.3, 1.0/10)
+                                              )
                          ),
         new NodeAnimator(
-                         NodeAnimatorFunctions(nullptr,
-                                               nullptr,
-                                               [](float v, float d) -> float { return v - 0.7; },
-                                               [](float v, float d) -> float { return 0.5 + sinf(d) * 0.1; },
-                                               [](float v, float d) -> float { return 0.2 + cosf(d/10) * 0.3; }
-                                               )
+                         NodeAnimatorChannels(AnimatorChannel::constant(),
+                                              AnimatorChannel::constant(),
+                                              AnimatorChannel::drift(-0.7),
+                                              AnimatorChannel::sine(0.5, 0.1, 1),
+                                              AnimatorChannel::cosine(0.2, 0.3, 1.0/10)
+                                              )
                          ),
     };
     
-    AnimatorChooser chooser = [](TreeNode *node, int depth, std::vector<NodeAnimator *> animators) -> NodeAnimator* {
-//        if (node->children.empty()) {
+    AnimatorChooser chooser = [](Tree *tree, int node, int depth, const std::vector<NodeAnimator *> &animators) -> NodeAnimator* {
+//        if (tree->nodes.childCount[node] == 0) {
 //            return animators[2];
 //        } else {
 //            return animators[ofRandom(3)];
@@ -146,120 +350,490 @@ void ofApp::setup(){
         return animators[3 + ofRandom(3)];
     };
     
+    // The tree owns the animators from here on.
     TreeAnimatorInstaller animatorInstaller = TreeAnimatorInstaller(tree,
                                                                     allAnimators,
                                                                     chooser);
-
     animatorInstaller.visitAll();
-    
-    
-    ofSetCircleResolution(200);
-//    ofEnableBlendMode(OF_BLENDMODE_SCREEN);
+}
 
-    ofSetFrameRate(frameRate);
-        
-    bufferWidth = ofGetWidth() * screenScale;
-    bufferHeight = ofGetHeight() * screenScale;
+//--------------------------------------------------------------
+void ofApp::reloadAnimators(){
+    // The worker mustn't be animating while the definitions change.
+    pipeline->waitIdle();
+    if (!animatorScript->load()) {
+        return;
+    }
+    // Only a change in the number of animators reassigns them; the tree
+    // keeps its shape either way.
+    if (!animatorScript->update(tree->animators)) {
+        installAnimators();
+    }
+    ofLogNotice("ofApp") << "loaded " << animatorScript->animatorCount() << " animators from " << animatorScript->path;
+}
 
-    drawBuffer.allocate(bufferWidth, bufferHeight);
-    drawBuffer.begin();
-    ofClear(0, 0, 0);
-    drawBuffer.end();
+//--------------------------------------------------------------
+void ofApp::teardownScene(){
+    // Joins the worker, which uses the animator and renderer.
+    delete pipeline;
+    pipeline = nullptr;
+    renderedTree = nullptr;
+    immediateTree = RenderedTree();
+    interpolatedTree = RenderedTree();
+    indexCurrent = false;
+    hoveredNode = -1;
+    selectedNodes.clear();
+    dragging = false;
     
-//    ofSetColor(200,200,220,200);
-//        ofSetColor(255, 0, 0, 50);
-    ofFill();
-    ofBackground(255, 255, 255);
-
+    delete drawer;
+    delete circleBatchDrawer;
+    delete leafDrawer;
+    delete leafBatchDrawer;
+    delete renderer;
+    delete animator;
+    delete track;
+    track = nullptr;
+    delete forest;
+    forest = nullptr;
+    delete tree;
+    tree = nullptr;
 }
 
 //--------------------------------------------------------------
 void ofApp::update(){
-    animator->visitAll(ofGetFrameNum() / (float)frameRate, true);
+    profiler->beginFrame();
+    FrameProfiler::Scope scope(profiler, phases.update);
+    // The simulation steps at the clock's fixed rate however fast frames
+    // are drawn, and the drawers see its last two steps blended.
+    int steps = simulationClock.advance(frameDuration());
+    profiler->count(counters.steps, steps);
+    indexCurrent = false;
+    
+    // Edits to the animator file take effect within half a second.
+    if (animatorScript != nullptr && ofGetElapsedTimef() >= nextAnimatorCheck) {
+        nextAnimatorCheck = ofGetElapsedTimef() + 0.5;
+        if (animatorScript->changed()) {
+            reloadAnimators();
+        }
+    }
+    
+    if (forest != nullptr) {
+        for (int step = 0; step < steps; step++) {
+            forest->animate(animationTime(simulatedFrame++));
+            // Only the last two steps are ever drawn.
+            if (step >= steps - 2) {
+                forest->render();
+                profiler->count(counters.transforms, forest->instanceCount() * forest->nodeCount());
+            }
+        }
+        forest->interpolate(simulationClock.alpha());
+        return;
+    }
+    
+    if (batched) {
+        // Each step takes the snapshot the worker finished and starts it on
+        // the next.
+        for (int step = 0; step < steps; step++) {
+            {
+                FrameProfiler::Scope wait(profiler, phases.wait);
+                pipeline->waitIdle();
+            }
+            pipeline->acquire();
+            profiler->count(counters.transforms, renderer->updatedNodes);
+            renderer->computeBounds = culled;
+            pipeline->submit(animationTime(simulatedFrame++));
+        }
+        float alpha = simulationClock.alpha();
+        if (alpha >= 1 || pipeline->previous().count() != pipeline->current().count()) {
+            renderedTree = &pipeline->current();
+        } else {
+            interpolatedTree.interpolate(pipeline->previous(), pipeline->current(), alpha, threadPool);
+            renderedTree = &interpolatedTree;
+        }
+    } else {
+        {
+            FrameProfiler::Scope wait(profiler, phases.wait);
+            pipeline->waitIdle();
+        }
+        renderer->computeBounds = culled;
+        // The immediate-mode drawers read the tree itself, so animate it here
+        // while the worker is idle. They draw the latest step as it is.
+        for (int step = 0; step < steps; step++) {
+            animator->animate(animationTime(simulatedFrame++));
+        }
+        if (culled) {
+            renderer->render(immediateTree);
+            profiler->count(counters.transforms, renderer->updatedNodes);
+        }
+    }
 }
 
 //--------------------------------------------------------------
 void ofApp::draw(){
+    int nodeCount = forest != nullptr ? forest->instanceCount() * forest->nodeCount() : tree->nodes.count();
+    updateCulling();
+    
     // Leaves 👇🏻
-    drawBuffer.begin();
-    ofTranslate(ofGetWidth() / 3, ofGetHeight() / 2);
-    ofScale(screenScale, screenScale);
-    leafDrawer->visitAll();
-    drawBuffer.end();
+    {
+        FrameProfiler::Scope scope(profiler, phases.leaves, true);
+        drawBuffer.begin();
+        // Forest coordinates are window coordinates.
+        if (forest == nullptr) {
+            ofTranslate(ofGetWidth() / 3, ofGetHeight() / 2);
+            ofScale(screenScale, screenScale);
+        }
+        if (batched) {
+            if (forest != nullptr) {
+                leafBatchDrawer->update(*forest);
+            } else {
+                leafBatchDrawer->update(*renderedTree);
+            }
+            leafBatchDrawer->draw();
+            profiler->count(counters.drawCalls, 1);
+            profiler->count(counters.vertices, leafBatchDrawer->lineCount() * 2);
+        } else {
+            leafDrawer->visitAll();
+            profiler->count(counters.drawCalls, nodeCount);
+            profiler->count(counters.vertices, nodeCount * 2);
+        }
+        drawBuffer.end();
+    }
     
-    drawBuffer.draw(0, 0);
+    {
+        FrameProfiler::Scope scope(profiler, phases.blit, true);
+        drawBuffer.draw(0, 0);
+        profiler->count(counters.drawCalls, 1);
+        profiler->count(counters.vertices, 4);
+    }
     // Leaves ☝🏻
     
     // Circles 👇🏻
-    ofSetColor(ofColor::fromHsb(128, 50, 200));
-    ofTranslate(ofGetWidth() / 6 * 5, ofGetHeight() / 2);
-    ofScale(screenScale / 2, screenScale / 2);
-
-    drawer->visitAll();
+    {
+        FrameProfiler::Scope scope(profiler, phases.circles, true);
+        ofPushMatrix();
+        ofSetColor(ofColor::fromHsb(128, 50, 200));
+        if (forest == nullptr) {
+            ofTranslate(ofGetWidth() / 6 * 5, ofGetHeight() / 2);
+            ofScale(screenScale / 2, screenScale / 2);
+        }
+        
+        if (batched) {
+            if (forest != nullptr) {
+                circleBatchDrawer->update(*forest);
+            } else {
+                circleBatchDrawer->update(*renderedTree);
+            }
+            circleBatchDrawer->draw();
+            profiler->count(counters.drawCalls, circleBatchDrawer->drawCount());
+            profiler->count(counters.vertices, circleBatchDrawer->vertexCount());
+        } else {
+            drawer->visitAll();
+            // One tessellated ellipse per node, roughly circleResolution vertices each.
+            profiler->count(counters.drawCalls, nodeCount);
+            profiler->count(counters.vertices, nodeCount * circleResolution);
+        }
+        ofPopMatrix();
+    }
     // Circles ☝🏻
+    
+    // Hovered and selected nodes, in the view they were picked in.
+    if (hoveredNode >= 0 || !selectedNodes.empty() || dragging) {
+        float originX, originY, scale;
+        getPickingView(originX, originY, scale);
+        ofPushMatrix();
+        ofPushStyle();
+        ofTranslate(originX, originY);
+        ofScale(scale, scale);
+        ofNoFill();
+        ofSetColor(255, 0, 0);
+        for (int i = 0; i < (int)selectedNodes.size() && i < maxOutlinedNodes; i++) {
+            outlineNode(selectedNodes[i]);
+        }
+        if (hoveredNode >= 0) {
+            outlineNode(hoveredNode);
+        }
+        if (dragging) {
+            ofPoint point = pickingPoint(ofGetMouseX(), ofGetMouseY());
+            ofDrawRectangle(pressPoint.x, pressPoint.y, point.x - pressPoint.x, point.y - pressPoint.y);
+        }
+        ofPopStyle();
+        ofPopMatrix();
+    }
+    
+    profiler->count(counters.nodes, nodeCount);
+    profiler->endFrame();
+    if (profiler->overlayVisible) {
+        profiler->drawOverlay(20, 20);
+    }
 }
 
 //--------------------------------------------------------------
-void ofApp::exit(){
+void ofApp::drawSoftware(ofPixels &pixels){
+    int nodeCount = forest != nullptr ? forest->instanceCount() * forest->nodeCount() : tree->nodes.count();
+    updateCulling();
+    
+    // The same passes as draw(), with the batch drawers' CPU side only.
+    {
+        FrameProfiler::Scope scope(profiler, phases.leaves);
+        if (forest != nullptr) {
+            softwareLeaves.setTransform(0, 0, 1);
+            leafBatchDrawer->update(*forest);
+        } else {
+            softwareLeaves.setTransform(ofGetWidth() / 3, ofGetHeight() / 2, screenScale);
+            leafBatchDrawer->update(*renderedTree);
+        }
+        leafBatchDrawer->draw(softwareLeaves);
+    }
+    
+    {
+        FrameProfiler::Scope scope(profiler, phases.blit);
+        softwareFrame.clear(ofFloatColor(1, 1, 1, 1));
+        softwareFrame.setColor(leafBatchDrawer->tint());
+        softwareFrame.draw(softwareLeaves);
+    }
+    
+    {
+        FrameProfiler::Scope scope(profiler, phases.circles);
+        softwareFrame.setColor(ofColor::fromHsb(128, 50, 200));
+        if (forest != nullptr) {
+            softwareFrame.setTransform(0, 0, 1);
+            circleBatchDrawer->update(*forest);
+        } else {
+            softwareFrame.setTransform(ofGetWidth() / 6 * 5, ofGetHeight() / 2, screenScale / 2);
+            circleBatchDrawer->update(*renderedTree);
+        }
+        circleBatchDrawer->draw(softwareFrame);
+    }
+    
+    profiler->count(counters.nodes, nodeCount);
+    profiler->endFrame();
+    softwareFrame.readToPixels(pixels);
+}
 
+//--------------------------------------------------------------
+void ofApp::setLevelOfDetail(bool enabled){
+    detailed = enabled;
+    for (LevelOfDetail *lod: { &drawer->lod, &circleBatchDrawer->lod }) {
+        lod->enabled = enabled;
+        // Matches the circles pass's ofScale in draw().
+        lod->pixelsPerUnit = forest != nullptr ? 1 : screenScale / 2;
+        lod->minPixelRadius = lodPixelRadius;
+    }
 }
 
 //--------------------------------------------------------------
-void ofApp::keyPressed(int key){
+void ofApp::updateCulling(){
+    // The same transforms draw() applies: the leaves pass draws into
+    // drawBuffer, the circles pass into the window.
+    // The forest's passes don't transform at all.
+    for (ViewportCulling *culling: { &leafDrawer->culling, &leafBatchDrawer->culling }) {
+        culling->enabled = culled;
+        if (forest != nullptr) {
+            culling->setTransform(0, 0, 1, bufferWidth, bufferHeight);
+        } else {
+            culling->setTransform(ofGetWidth() / 3, ofGetHeight() / 2, screenScale, bufferWidth, bufferHeight);
+        }
+    }
+    for (ViewportCulling *culling: { &drawer->culling, &circleBatchDrawer->culling }) {
+        culling->enabled = culled && screenScale / 2 > 0;
+        if (culling->enabled && forest != nullptr) {
+            culling->setTransform(0, 0, 1, ofGetWidth(), ofGetHeight());
+        } else if (culling->enabled) {
+            culling->setTransform(ofGetWidth() / 6 * 5, ofGetHeight() / 2, screenScale / 2, ofGetWidth(), ofGetHeight());
+        }
+    }
+    leafDrawer->renderedTree = &immediateTree;
+    drawer->renderedTree = &immediateTree;
+}
 
+//--------------------------------------------------------------
+void ofApp::updateSpatialIndex(){
+    if (indexCurrent) {
+        return;
+    }
+    indexCurrent = true;
+    if (forest != nullptr) {
+        spatialIndex.update(*forest);
+    } else if (batched) {
+        // Bounds come with the snapshot when culling, so indexing it is free.
+        spatialIndex.update(tree, *renderedTree);
+    } else {
+        // The immediate drawers read the tree, which update() only renders
+        // into immediateTree when culling. The worker is idle in this mode.
+        if (!culled) {
+            renderer->render(immediateTree);
+        }
+        spatialIndex.update(tree, immediateTree);
+    }
 }
 
 //--------------------------------------------------------------
-void ofApp::keyReleased(int key){
+ofPoint ofApp::pickingPoint(int x, int y){
+    float originX, originY, scale;
+    getPickingView(originX, originY, scale);
+    return ofPoint((x - originX) / scale, (y - originY) / scale);
+}
 
+//--------------------------------------------------------------
+void ofApp::outlineNode(int id){
+    float radius = tree->size / 2;
+    if (forest != nullptr) {
+        const std::vector<ForestNode> &nodes = forest->nodes();
+        if (id < (int)nodes.size()) {
+            ofDrawCircle(nodes[id].x, nodes[id].y, fabsf(radius * nodes[id].scale));
+        }
+        return;
+    }
+    const RenderedTree &snapshot = batched ? *renderedTree : immediateTree;
+    if (id < snapshot.count()) {
+        const RenderedTreeNode &node = snapshot.nodes[id];
+        ofDrawCircle(node.position.x, node.position.y, fabsf(radius * node.scale));
+    }
 }
 
 //--------------------------------------------------------------
-void ofApp::mouseMoved(int x, int y ){
+float ofApp::animationTime(uint64_t frame){
+    return frame / (simulationRate > 0 ? simulationRate : (float)frameRate);
+}
 
+//--------------------------------------------------------------
+double ofApp::frameDuration(){
+    return ofGetLastFrameTime();
 }
 
 //--------------------------------------------------------------
-void ofApp::mouseDragged(int x, int y, int button){
+void ofApp::exit(){
+    teardownScene();
+    delete threadPool;
+    threadPool = nullptr;
+    delete profiler;
+    profiler = nullptr;
+    delete animatorScript;
+    animatorScript = nullptr;
+    
+}
 
+//--------------------------------------------------------------
+void ofApp::keyPressed(int key){
+    if (key == 'b') {
+        // The forest has no immediate mode.
+        if (forest != nullptr) {
+            return;
+        }
+        batched = !batched;
+        // Picking reads the other mode's snapshot from here on.
+        indexCurrent = false;
+        if (batched) {
+            // The last snapshot predates the immediate-mode frames.
+            pipeline->waitIdle();
+            pipeline->submit(animationTime(simulatedFrame++));
+        }
+    } else if (key == 'r') {
+        // A fresh tree with new animator assignments; the old one is freed.
+        teardownScene();
+        buildScene();
+    } else if (key == 's') {
+        // Loads back with treeFile, or --tree when rendering offline.
+        std::string path = ofToDataPath("tree.ctree");
+        pipeline->waitIdle();
+        if (tree->save(path)) {
+            ofLogNotice("ofApp") << "saved " << tree->nodes.count() << " nodes to " << path;
+        }
+    } else if (key == 't') {
+        // Bakes the next ten seconds from the tree as it is now. Load the
+        // pair with treeFile and trackFile, or --tree and --track.
+        // One sample per simulation step.
+        float stepRate = 1 / animationTime(1);
+        pipeline->waitIdle();
+        if (tree->save(ofToDataPath("tree.ctree")) &&
+            AnimationTrack::record(*animator, ofToDataPath("track.ctrack"), animationTime(simulatedFrame), stepRate, (int)(10 * stepRate))) {
+            ofLogNotice("ofApp") << "saved tree.ctree and track.ctrack";
+        }
+    } else if (key == 'v') {
+        culled = !culled;
+    } else if (key == 'l') {
+        setLevelOfDetail(!detailed);
+    } else if (key == 'p') {
+        profiler->overlayVisible = !profiler->overlayVisible;
+    } else if (key == 'P') {
+        // Dumps the profiler's ring of recent frames into bin/data.
+        std::string name = "profile-" + ofGetTimestampString();
+        profiler->writeCsv(ofToDataPath(name + ".csv"));
+        profiler->writeChromeTrace(ofToDataPath(name + ".json"));
+        ofLogNotice("ofApp") << "wrote " << name << ".csv and " << name << ".json";
+    }
 }
 
 //--------------------------------------------------------------
-void ofApp::mousePressed(int x, int y, int button){
+void ofApp::keyReleased(int key){
+    
+}
 
+//--------------------------------------------------------------
+void ofApp::mouseMoved(int x, int y ){
+    pickingCircles = overCircles(x);
+    updateSpatialIndex();
+    ofPoint point = pickingPoint(x, y);
+    hoveredNode = spatialIndex.nodeAt(point.x, point.y);
 }
 
 //--------------------------------------------------------------
-void ofApp::mouseReleased(int x, int y, int button){
+void ofApp::mouseDragged(int x, int y, int button){
+    if (!dragging) {
+        return;
+    }
+    // Everything touching the rectangle from the press to here.
+    updateSpatialIndex();
+    ofPoint point = pickingPoint(x, y);
+    spatialIndex.queryRectangle(ofRectangle(pressPoint.x, pressPoint.y, point.x - pressPoint.x, point.y - pressPoint.y), selectedNodes);
+}
+
+//--------------------------------------------------------------
+void ofApp::mousePressed(int x, int y, int button){
+    // Selects the deepest node under the point, or nothing, until a drag
+    // selects more.
+    pickingCircles = overCircles(x);
+    updateSpatialIndex();
+    pressPoint = pickingPoint(x, y);
+    hoveredNode = spatialIndex.nodeAt(pressPoint.x, pressPoint.y);
+    selectedNodes.clear();
+    if (hoveredNode >= 0) {
+        selectedNodes.push_back(hoveredNode);
+    }
+    dragging = true;
+}
 
+//--------------------------------------------------------------
+void ofApp::mouseReleased(int x, int y, int button){
+    dragging = false;
 }
 
 //--------------------------------------------------------------
 void ofApp::mouseScrolled(int x, int y, float scrollX, float scrollY){
-
+    
 }
 
 //--------------------------------------------------------------
 void ofApp::mouseEntered(int x, int y){
-
+    
 }
 
 //--------------------------------------------------------------
 void ofApp::mouseExited(int x, int y){
-
+    
 }
 
 //--------------------------------------------------------------
 void ofApp::windowResized(int w, int h){
-
+    
 }
 
 //--------------------------------------------------------------
 void ofApp::gotMessage(ofMessage msg){
-
+    
 }
 
 //--------------------------------------------------------------
 void ofApp::dragEvent(ofDragInfo dragInfo){ 
-
+    
 }
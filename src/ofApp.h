@@ -22,5 +22,43 @@ class ofApp : public ofBaseApp{
 		void windowResized(int w, int h) override;
 		void dragEvent(ofDragInfo dragInfo) override;
 		void gotMessage(ofMessage msg) override;
-		
+
+		// Animation time for a simulation step, in seconds.
+		virtual float animationTime(uint64_t frame);
+		// Seconds the last frame took, which the simulation clock advances by.
+		virtual double frameDuration();
+		void buildScene();
+		// Generates the animators and assigns them to the tree's nodes.
+		void installAnimators();
+		// Rereads animatorFile into the tree's animators.
+		void reloadAnimators();
+		// Tiles forestSize instances of the tree over the window.
+		void plantForest();
+		void teardownScene();
+		void setLevelOfDetail(bool enabled);
+		void updateCulling();
+		// Indexes the frame being drawn for picking, at most once a frame.
+		void updateSpatialIndex();
+		// Window coordinates to tree coordinates in the view being picked in.
+		ofPoint pickingPoint(int x, int y);
+		// Outlines a picked node's circle, in tree coordinates.
+		void outlineNode(int id);
+		// Draws the frame on the CPU and reads it into pixels, in place of
+		// draw(). Needs softwareRendering set before setup().
+		void drawSoftware(ofPixels &pixels);
+
+		// Scene parameters, read by setup().
+		int windowWidth = 1500;
+		int windowHeight = 1000;
+		int treeDepth = 4;
+		int treeSize = 0; // 0 uses windowHeight / 6
+		uint64_t randomSeed = 0; // 0 seeds from the clock
+		float lodPixelRadius = 0.5; // circles smaller than this are culled; 0 draws everything
+		bool softwareRendering = false; // no GL context; frames come from drawSoftware()
+		std::string treeFile; // a Tree::save snapshot to load instead of generating
+		std::string trackFile; // an AnimationTrack to play instead of running the animators
+		std::string animatorFile; // an AnimatorScript to use instead of the built-in animators, reloaded when it changes
+		float simulationRate = 120; // fixed simulation steps per second, interpolated when drawing; 0 steps once per drawn frame
+		int forestSize = 0; // trees tiled over the window, sharing the one tree's topology; 0 draws the single tree
+
 };